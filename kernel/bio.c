@@ -1,10 +1,27 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Buffers are hashed by (dev, blockno) into buckets, each with
+// its own lock, so lookups of different blocks don't contend.
+// Misses are serialized by bcache.lock; a miss recycles the
+// least recently used unreferenced buffer in the whole cache,
+// moving it to the new block's bucket. Unreferenced buffers
+// are also on one LRU free list, with its own lock, so the
+// miss finds that buffer at the list's tail without looking
+// through the buckets. A bucket lock is taken before the
+// free list's lock, never after.
+//
+// The cache is sized to memory: it starts with NBUF buffers
+// and, while free memory allows, grows on a miss (rather than
+// recycling) until it reaches a target set at boot from the
+// amount of free memory. Buffer data comes BPP blocks to a
+// page from kalloc(); when kalloc() runs out, it calls
+// bshrink() to give back pages whose buffers are all unused.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -22,70 +39,307 @@
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
+#include "kstat.h"
 
-struct {
+#define NBUCKET 509
+#define BHASH(dev, blockno) ((((dev) << 16) ^ (blockno)) % NBUCKET)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+};
+
+#define BPP (PGSIZE / BSIZE)  // buffers per page of data
+
+// don't grow the cache when fewer pages than this are free.
+#define BMINFREE 512
+
+// A page of buffer data, shared by BPP buffers.
+struct bpage {
+  struct bpage *next;
+  char *data;
+  struct buf *buf[BPP];
+};
+
+struct {
+  // held while adding, recycling or removing buffers.
+  struct spinlock lock;
+  struct bucket bucket[NBUCKET];
+
+  // unreferenced buffers, through fprev/fnext: freelist.fnext
+  // is the most recently used, freelist.fprev the least.
+  // Protected by freelock.
+  struct spinlock freelock;
+  struct buf freelist;
+
+  // these are protected by lock.
+  struct bpage *pages;   // all data pages
+  struct bpage *hand;    // where bshrink() looks next
+  uint nbuf;
+  uint target;           // grow up to this many buffers
+
+  struct slab bufslab;   // struct buf
+  struct slab pageslab;  // struct bpage
+
+  // statistics, updated atomically.
+  uint64 nhit;
+  uint64 nmiss;
+  uint64 nevict;  // misses that displaced another cached block
+  uint64 nshrink; // buffers given back to kalloc()
+  uint64 nreadahead; // reads started by breadahead()
 } bcache;
 
+// Insert b at the most recently used end of bk's list.
+static void
+binsert(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Insert b at the least recently used end of bk's list.
+static void
+binserttail(struct bucket *bk, struct buf *b)
+{
+  b->next = &bk->head;
+  b->prev = bk->head.prev;
+  bk->head.prev->next = b;
+  bk->head.prev = b;
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Put b, which has just become unused, on the free list:
+// at the most recently used end, or the least if tail.
+// Caller holds b's bucket lock.
+static void
+bfreeput(struct buf *b, int tail)
+{
+  struct buf *h = &bcache.freelist;
+
+  acquire(&bcache.freelock);
+  if(tail){
+    b->fnext = h;
+    b->fprev = h->fprev;
+  } else {
+    b->fnext = h->fnext;
+    b->fprev = h;
+  }
+  b->fnext->fprev = b;
+  b->fprev->fnext = b;
+  release(&bcache.freelock);
+}
+
+// Take b, which is about to be used, off the free list.
+// Caller holds b's bucket lock.
+static void
+bfreeunlink(struct buf *b)
+{
+  acquire(&bcache.freelock);
+  b->fnext->fprev = b->fprev;
+  b->fprev->fnext = b->fnext;
+  release(&bcache.freelock);
+}
+
+// Add a page's worth of buffers to the cache, and return
+// one of them, unhashed and with a reference held; the
+// others go, unused, on bucket BHASH(0, 0).
+// Returns 0 if out of memory. Caller must hold bcache.lock.
+static struct buf*
+bgrow(void)
+{
+  struct bpage *pg;
+  struct bucket *bk = &bcache.bucket[BHASH(0, 0)];
+  int i;
+
+  if((pg = slaballoc(&bcache.pageslab)) == 0)
+    return 0;
+  if((pg->data = kalloc()) == 0)
+    goto bad;
+  for(i = 0; i < BPP; i++){
+    if((pg->buf[i] = slaballoc(&bcache.bufslab)) == 0)
+      goto bad;
+    initsleeplock(&pg->buf[i]->lock, "buffer");
+    pg->buf[i]->data = (uchar*)pg->data + i*BSIZE;
+  }
+
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.nbuf += BPP;
+
+  acquire(&bk->lock);
+  for(i = 1; i < BPP; i++){
+    binserttail(bk, pg->buf[i]);
+    bfreeput(pg->buf[i], 1);
+  }
+  release(&bk->lock);
+  pg->buf[0]->refcnt = 1;
+  return pg->buf[0];
+
+bad:
+  for(i = 0; i < BPP && pg->buf[i]; i++)
+    slabfree(&bcache.bufslab, pg->buf[i]);
+  if(pg->data)
+    kfree(pg->data);
+  slabfree(&bcache.pageslab, pg);
+  return 0;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  initlock(&bcache.freelock, "bcache.free");
+  bcache.freelist.fprev = &bcache.freelist;
+  bcache.freelist.fnext = &bcache.freelist;
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
+  slabinit(&bcache.bufslab, "buf", sizeof(struct buf));
+  slabinit(&bcache.pageslab, "bpage", sizeof(struct bpage));
+
+  // let the cache grow to 1/BCACHEFRAC of free memory.
+  bcache.target = kfreepages() / BCACHEFRAC * BPP;
+  if(bcache.target < NBUF)
+    bcache.target = NBUF;
+
+  acquire(&bcache.lock);
+  while(bcache.nbuf < NBUF){
+    if((b = bgrow()) == 0)
+      panic("binit");
+    b->refcnt = 0;
+    bk = &bcache.bucket[BHASH(0, 0)];
+    acquire(&bk->lock);
+    binserttail(bk, b);
+    bfreeput(b, 1);
+    release(&bk->lock);
+  }
+  release(&bcache.lock);
+}
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Look for block blockno of dev in bucket bk,
+// whose lock the caller holds.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
   }
+  return 0;
+}
+
+// Take the least recently used unreferenced buffer, at the
+// tail of the free list, out of its bucket and return it with
+// a reference held, or 0 if every buffer is in use.
+// Caller must hold bcache.lock, so the buffer can't change
+// blocks, or be freed, after freelock is released.
+static struct buf*
+bvictim(void)
+{
+  struct bucket *bk;
+  struct buf *b;
+
+  for(;;){
+    acquire(&bcache.freelock);
+    b = bcache.freelist.fprev;
+    release(&bcache.freelock);
+    if(b == &bcache.freelist)
+      return 0;
+    bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    if(b->refcnt == 0)
+      break;
+    // a hit took it before we got the bucket lock.
+    release(&bk->lock);
+  }
+  bfreeunlink(b);
+  bunlink(b);
+  b->refcnt = 1;
+  release(&bk->lock);
+  return b;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// If every buffer is in use, panic, or return 0 if the
+// caller is only reading ahead.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ahead)
 {
+  struct bucket *bk = &bcache.bucket[BHASH(dev, blockno)];
   struct buf *b;
 
-  acquire(&bcache.lock);
-
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0 && b->refcnt++ == 0)
+    bfreeunlink(b);
+  release(&bk->lock);
+  if(b)
+    goto found;
+
+  // Not cached. Look again once no other miss is in
+  // progress, since one might have been for this block.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  if((b = bfind(bk, dev, blockno)) != 0 && b->refcnt++ == 0)
+    bfreeunlink(b);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    goto found;
   }
 
-  // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  // Grow the cache if there's room, or else recycle
+  // the least recently used (LRU) unused buffer.
+  b = 0;
+  if(bcache.nbuf < bcache.target && kfreepages() > BMINFREE)
+    b = bgrow();
+  if(b == 0)
+    b = bvictim();
+  if(b == 0){
+    if(!ahead)
+      panic("bget: no buffers");
+    release(&bcache.lock);
+    return 0;
   }
-  panic("bget: no buffers");
+  if(b->valid)
+    __sync_fetch_and_add(&bcache.nevict, 1);
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  acquire(&bk->lock);
+  binsert(bk, b);
+  release(&bk->lock);
+  release(&bcache.lock);
+  __sync_fetch_and_add(&bcache.nmiss, 1);
+  acquiresleep(&b->lock);
+  return b;
+
+found:
+  __sync_fetch_and_add(&bcache.nhit, 1);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,9 +348,9 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    iorw(b, 0);
     b->valid = 1;
   }
   return b;
@@ -108,11 +362,107 @@ bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  iorw(b, 1);
+}
+
+// Write the contents of n locked buffers to disk, letting
+// the I/O scheduler merge and order them, and wait for all.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+    iostart(bs[i], 1, 0);
+  }
+  iokick();
+  for(i = 0; i < n; i++)
+    iowait(bs[i]);
+}
+
+// Write the contents of n locked buffers to the n consecutive
+// blocks of their device starting at blockno, rather than to
+// their own blocks, and wait. The writes go to the disk as a
+// single request (n must be at most MAXSEG).
+void
+bwriteat(struct buf **bs, int n, uint blockno)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock) || bs[i]->dev != bs[0]->dev)
+      panic("bwriteat");
+    iostartat(bs[i], blockno + i, 1, 0);
+  }
+  iokick();
+  for(i = 0; i < n; i++)
+    iowait(bs[i]);
+}
+
+// Start reading block blockno of dev into the cache, unless
+// it's already there, without waiting for the disk.
+// The read is only queued; call bkick() after a batch.
+// Returns -1 if there's no buffer to spare for it.
+int
+breadahead(uint dev, uint blockno)
+{
+  struct bucket *bk = &bcache.bucket[BHASH(dev, blockno)];
+  struct buf *b;
+  int cached;
+
+  // while the cache is small, leave its buffers to the
+  // log and to reads that are actually waiting.
+  if(bcache.nbuf < 2*NBUF)
+    return -1;
+
+  acquire(&bk->lock);
+  cached = bfind(bk, dev, blockno) != 0;
+  release(&bk->lock);
+  if(cached)
+    return 0;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return -1;
+  if(b->valid){
+    brelse(b);
+    return 0;
+  }
+  iostart(b, 0, 1);
+  __sync_fetch_and_add(&bcache.nreadahead, 1);
+  return 0;
+}
+
+// Send the disk the reads queued by breadahead().
+void
+bkick(void)
+{
+  iokick();
+}
+
+// Drop a reference to b, and if it was the last one, move b
+// to the most recently used end of its bucket's list and of
+// the free list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  // b can't change buckets while we hold a reference.
+  bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    binsert(bk, b);
+    bfreeput(b, 0);
+  }
+  release(&bk->lock);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
 void
 brelse(struct buf *b)
 {
@@ -120,34 +470,128 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Called by the disk driver, in an interrupt, when a read
+// started by breadahead() has finished: the data is valid,
+// and nobody is using the buffer any more.
+void
+bdone(struct buf *b)
+{
+  b->valid = 1;
+  releasesleep(&b->lock);
+  bput(b);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
-  b->refcnt++;
-  release(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(b->refcnt++ == 0)
+    bfreeunlink(b);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
+  struct bucket *bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bk->lock);
+  if(--b->refcnt == 0)
+    bfreeput(b, 0);
+  release(&bk->lock);
+}
+
+// Take all of pg's buffers out of the cache, if none of them
+// is in use. Returns 0 on success, -1 if one is in use.
+// Caller must hold bcache.lock, so buffers can't change
+// blocks (and thus buckets) underfoot.
+static int
+bclaim(struct bpage *pg)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int i, j, busy;
+
+  for(i = 0; i < BPP; i++){
+    b = pg->buf[i];
+    bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    busy = b->refcnt != 0;
+    if(!busy){
+      bunlink(b);
+      bfreeunlink(b);
+    }
+    release(&bk->lock);
+    if(busy)
+      break;
+  }
+  if(i == BPP)
+    return 0;
+
+  // put back the ones already taken.
+  for(j = 0; j < i; j++){
+    b = pg->buf[j];
+    bk = &bcache.bucket[BHASH(b->dev, b->blockno)];
+    acquire(&bk->lock);
+    binserttail(bk, b);
+    bfreeput(b, 1);
+    release(&bk->lock);
+  }
+  return -1;
+}
+
+// Give up to npages pages of unused buffers back to kalloc(),
+// keeping at least NBUF buffers. Called by kalloc() when it
+// runs out of memory. Returns the number of pages freed.
+int
+bshrink(int npages)
+{
+  struct bpage *pg, **pp;
+  int i, n = 0, scanned = 0;
+
+  // kalloc() called from bgrow(): nothing to give.
+  if(holding(&bcache.lock))
+    return 0;
+
   acquire(&bcache.lock);
-  b->refcnt--;
+  // look at each page at most once, starting at the hand.
+  pg = bcache.hand ? bcache.hand : bcache.pages;
+  while(n < npages && bcache.nbuf >= NBUF + BPP && scanned++ < bcache.nbuf / BPP){
+    if(pg == 0)
+      pg = bcache.pages;
+    if(bclaim(pg) < 0){
+      pg = pg->next;
+      continue;
+    }
+    for(pp = &bcache.pages; *pp != pg; pp = &(*pp)->next)
+      ;
+    *pp = pg->next;
+    bcache.nbuf -= BPP;
+    __sync_fetch_and_add(&bcache.nshrink, BPP);
+    for(i = 0; i < BPP; i++)
+      slabfree(&bcache.bufslab, pg->buf[i]);
+    kfree(pg->data);
+    slabfree(&bcache.pageslab, pg);
+    pg = *pp;
+    n++;
+  }
+  bcache.hand = pg;
   release(&bcache.lock);
+  return n;
 }
 
-
+// Copy out the buffer cache counters.
+void
+bcachestat(struct bcachestat *st)
+{
+  st->nbuf = bcache.nbuf;
+  st->target = bcache.target;
+  st->nhit = bcache.nhit;
+  st->nmiss = bcache.nmiss;
+  st->nevict = bcache.nevict;
+  st->nshrink = bcache.nshrink;
+  st->nreadahead = bcache.nreadahead;
+}
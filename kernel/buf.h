@@ -1,12 +1,18 @@
 struct buf {
   int valid;   // has data been read from disk?
   int disk;    // does disk "own" buf?
+  char iowrite;  // queued transfer is a write
+  char ioasync;  // on completion, call bdone() instead of waking a waiter
+  struct buf *qnext; // I/O queue, then the rest of a disk request
+  uint ioblock;      // disk block of the queued transfer
   uint dev;
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  struct buf *prev; // bucket's LRU list
   struct buf *next;
-  uchar data[BSIZE];
+  struct buf *fprev; // cache-wide LRU list of unused bufs
+  struct buf *fnext;
+  uchar *data;      // BSIZE bytes, in a page shared with other bufs
 };
 
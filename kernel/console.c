@@ -21,6 +21,7 @@
 #include "riscv.h"
 #include "defs.h"
 #include "proc.h"
+#include "poll.h"
 
 #define BACKSPACE 0x100
 #define C(x)  ((x)-'@')  // Control-x
@@ -126,6 +127,23 @@ consoleread(int user_dst, uint64 dst, int n)
   return target - n;
 }
 
+//
+// for poll(): input is ready once a whole line is,
+// and output always is.
+//
+int
+consolepoll(struct pollent *pe)
+{
+  int r = POLLOUT;
+
+  pollwait(pe, &cons.r);
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 //
 // the console input interrupt handler.
 // uartintr() calls this for input character.
@@ -189,4 +207,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
@@ -0,0 +1,196 @@
+// Directory entry cache.
+//
+// Remembers the result of looking up a name in a directory,
+// so that dirlookup() can skip reading the directory's
+// blocks. Entries are hashed by (device, directory inode,
+// name). An entry with inum 0 is negative: it records that
+// the directory has no such name, which is the usual answer
+// when a shell searches for a command.
+//
+// The caller of every function here must hold the
+// directory's sleeplock, so the directory can't change
+// between reading it and entering the result. dirlink() and
+// unlink() update the entry for the name they change; when a
+// directory is freed, dcachepurge() drops all its entries so
+// they can't be mistaken for entries of the directory that
+// next gets its inode number.
+//
+// A fixed pool of NDCACHE entries is recycled in LRU order,
+// all protected by dcache.lock.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "file.h"
+#include "kstat.h"
+
+#define NDHASH 127
+
+struct dentry {
+  uint dev;
+  uint dir;             // inode number of the directory
+  char name[DIRSIZ];
+  uint inum;            // 0 if the directory has no such name
+  uint off;             // byte offset of the entry in the directory
+  struct dentry *hnext; // hash chain
+  struct dentry *prev;  // LRU list, most recent first
+  struct dentry *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct dentry entry[NDCACHE];
+  struct dentry *hash[NDHASH];
+  struct dentry head;   // LRU list
+
+  uint64 nhit;
+  uint64 nneg;
+  uint64 nmiss;
+} dcache;
+
+static uint
+dhash(uint dev, uint dir, char *name)
+{
+  uint h = dev * 31 + dir;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 31 + (uchar)name[i];
+  return h % NDHASH;
+}
+
+void
+dcacheinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.head.prev = &dcache.head;
+  dcache.head.next = &dcache.head;
+  for(d = dcache.entry; d < dcache.entry+NDCACHE; d++){
+    d->dir = 0;  // not hashed
+    d->next = dcache.head.next;
+    d->prev = &dcache.head;
+    dcache.head.next->prev = d;
+    dcache.head.next = d;
+  }
+}
+
+// Move d to the front of the LRU list.
+static void
+dtouch(struct dentry *d)
+{
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.head.next;
+  d->prev = &dcache.head;
+  dcache.head.next->prev = d;
+  dcache.head.next = d;
+}
+
+// Take d off its hash chain. Caller holds dcache.lock.
+static void
+dunhash(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.hash[dhash(d->dev, d->dir, d->name)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == d){
+      *pp = d->hnext;
+      break;
+    }
+  }
+  d->dir = 0;
+}
+
+// Find the entry for name in directory dp. Caller holds dcache.lock.
+static struct dentry*
+dfind(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.hash[dhash(dp->dev, dp->inum, name)]; d; d = d->hnext)
+    if(d->dev == dp->dev && d->dir == dp->inum && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Look name up in the cache for directory dp.
+// Returns -1 if the cache doesn't know, 0 if dp has no
+// such name, or else the name's inode number, setting
+// *poff (if not 0) to the entry's offset in dp.
+int
+dcachelookup(struct inode *dp, char *name, uint *poff)
+{
+  struct dentry *d;
+  int inum = -1;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) != 0){
+    dtouch(d);
+    inum = d->inum;
+    if(inum && poff)
+      *poff = d->off;
+    if(inum)
+      dcache.nhit++;
+    else
+      dcache.nneg++;
+  } else {
+    dcache.nmiss++;
+  }
+  release(&dcache.lock);
+  return inum;
+}
+
+// Record that name in directory dp refers to inode inum,
+// in the entry at offset off, or that there is no such
+// name if inum is 0.
+void
+dcacheenter(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp, name)) == 0){
+    // recycle the least recently used entry.
+    d = dcache.head.prev;
+    if(d->dir)
+      dunhash(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    d->hnext = dcache.hash[dhash(d->dev, d->dir, d->name)];
+    dcache.hash[dhash(d->dev, d->dir, d->name)] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  dtouch(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dp, which is being freed.
+void
+dcachepurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry+NDCACHE; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dunhash(d);
+  release(&dcache.lock);
+}
+
+// Copy out the cache's counters.
+void
+dcachestat(struct dcachestat *st)
+{
+  acquire(&dcache.lock);
+  st->nhit = dcache.nhit;
+  st->nneg = dcache.nneg;
+  st->nmiss = dcache.nmiss;
+  release(&dcache.lock);
+}
@@ -3,19 +3,40 @@ struct context;
 struct file;
 struct inode;
 struct pipe;
+struct pollent;
 struct proc;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct kmemstat;
+struct schedstat;
+struct bcachestat;
+struct slab;
+struct diskstat;
+struct dcachestat;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            bwriteat(struct buf**, int, uint);
+int             breadahead(uint, uint);
+void            bkick(void);
+void            bdone(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bcachestat(struct bcachestat*);
+int             bshrink(int);
+
+// dcache.c
+void            dcacheinit(void);
+int             dcachelookup(struct inode*, char*, uint*);
+void            dcacheenter(struct inode*, char*, uint, uint);
+void            dcachepurge(struct inode*);
+void            dcachestat(struct dcachestat*);
 
 // console.c
 void            consoleinit(void);
@@ -33,49 +54,83 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filesplice(struct file*, struct file*, int n);
+int             filepoll(struct file*, struct pollent*);
 
 // fs.c
 void            fsinit(int);
 int             dirlink(struct inode*, char*, uint);
+int             dirpath(struct inode*, char*, int);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+struct inode*   iexec(struct inode*);
+void            iputexec(struct inode*);
 void            iinit();
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
 void            iunlockput(struct inode*);
 void            iupdate(struct inode*);
+uint            readahead(struct inode*, uint, uint);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
-int             getcwd(char *, uint);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// iosched.c
+void            ioinit(void);
+void            iostart(struct buf*, int, int);
+void            iostartat(struct buf*, uint, int, int);
+void            iokick(void);
+void            iowait(struct buf*);
+void            iorw(struct buf*, int);
+void            iostat(struct diskstat*);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
 void            kinit(void);
+void            kallocstat(struct kmemstat*);
+void            kaddref(void *);
+int             krefcnt(void *);
+uint64          kfreepages(void);
 
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
 void            begin_op(void);
 void            end_op(void);
+void            log_tick(void);
+void            log_sync(void);
+
+// mmap.c
+uint64          mmapbase(struct proc*);
+int             mmapfault(struct proc*, uint64, int);
+void            mmappagein(struct proc*, uint64, uint64);
+void            mmapclear(struct proc*, pagetable_t);
+int             mmapfork(struct proc*, struct proc*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, int, uint64, int, int);
+int             pipewrite(struct pipe*, int, uint64, int, int);
+int             pipepoll(struct pipe*, int, struct pollent*);
+int             pipewait(struct pipe*);
+int             pipeput(struct pipe*, char*, int);
+int             pipesize(struct pipe*);
+int             pipesetsize(struct pipe*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -103,14 +158,25 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+void            pollwait(struct pollent*, void*);
+void            pollcancel(struct pollent*);
+void            pollstart(void);
+void            pollsleep(void);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+void            kthread(void (*)(void), char*);
+void            runqstat(struct schedstat*);
 
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// slab.c
+void            slabinit(struct slab*, char*, uint);
+void*           slaballoc(struct slab*);
+void            slabfree(struct slab*, void*);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
@@ -134,6 +200,9 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// sysfile.c
+int             fileopen(char*, int);
+
 // syscall.c
 void            argint(int, int*);
 int             argstr(int, char*, int);
@@ -166,6 +235,9 @@ void            uvmfirst(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             vmfault(pagetable_t, uint64, int);
+void            uvmpagein(uint64, uint64);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
@@ -183,7 +255,9 @@ void            plic_complete(int);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
+int             virtio_disk_start(struct buf *, int);
+void            virtio_disk_kick(void);
+void            virtio_disk_wait(struct buf *);
 void            virtio_disk_intr(void);
 
 // number of elements in fixed-size array
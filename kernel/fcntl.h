@@ -1,6 +1,13 @@
 #define O_RDONLY  0x000
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
+#define O_NONBLOCK 0x004
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
 #define O_APPEND  0x800
+
+// fcntl() commands
+#define F_GETPIPE_SZ 1  // size of a pipe's buffer
+#define F_SETPIPE_SZ 2  // resize a pipe's buffer; returns the new size
+#define F_GETFL      3  // the open mode: O_RDONLY, O_WRONLY or O_RDWR, and O_NONBLOCK
+#define F_SETFL      4  // set or clear O_NONBLOCK
@@ -12,6 +12,7 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "poll.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -101,26 +102,57 @@ filestat(struct file *f, uint64 addr)
   return -1;
 }
 
-// Read from file f.
-// addr is a user virtual address.
-int
-fileread(struct file *f, uint64 addr, int n)
+// After a sequential read of f, read ahead the next
+// f->rawin blocks, doubling the window each time up to
+// MAXREADAHEAD. Blocks already read ahead aren't asked
+// for again. Caller must hold f->ip->lock.
+static void
+filereadahead(struct file *f)
 {
-  int r = 0;
+  uint bn = (f->off + BSIZE - 1) / BSIZE;  // next block to read
 
-  if(f->readable == 0)
-    return -1;
+  if(f->rawin == 0)
+    f->rawin = 2;
+  else if(f->rawin < MAXREADAHEAD)
+    f->rawin *= 2;
+  if(f->ranext < bn)
+    f->ranext = bn;
+  if(f->ranext < bn + f->rawin)
+    f->ranext += readahead(f->ip, f->ranext, bn + f->rawin - f->ranext);
+}
+
+// Read up to n bytes from file f to addr, a user virtual
+// address if user_dst==1 and a kernel address otherwise.
+// If nonblock, a pipe or device with nothing to read
+// returns -1 rather than waiting.
+static int
+readfile(struct file *f, int user_dst, uint64 addr, int n, int nonblock)
+{
+  int r = 0;
 
   if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
+    r = piperead(f->pipe, user_dst, addr, n, nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
       return -1;
-    r = devsw[f->major].read(1, addr, n);
+    // another reader could take the input between the
+    // check and the read, which would then wait for more.
+    if(nonblock && devsw[f->major].poll &&
+       (devsw[f->major].poll(0) & POLLIN) == 0)
+      return -1;
+    r = devsw[f->major].read(user_dst, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
+    if(f->off != f->raoff){
+      // not where the last read left off: start over.
+      f->rawin = 0;
+      f->ranext = 0;
+    }
+    if((r = readi(f->ip, user_dst, addr, f->off, n)) > 0)
       f->off += r;
+    if(r > 0)
+      filereadahead(f);
+    f->raoff = f->off;
     iunlock(f->ip);
   } else {
     panic("fileread");
@@ -129,30 +161,28 @@ fileread(struct file *f, uint64 addr, int n)
   return r;
 }
 
-// Write to file f.
-// addr is a user virtual address.
-int
-filewrite(struct file *f, uint64 addr, int n)
+// Write n bytes from addr to file f; user_src and
+// nonblock are as for readfile(), except that a
+// non-blocking write to a pipe writes what fits.
+// Returns the number of bytes written, short of n for an
+// inode only after an error, or -1 if none were.
+static int
+writefile(struct file *f, int user_src, uint64 addr, int n, int nonblock)
 {
   int r, ret = 0;
 
-  if(f->writable == 0)
-    return -1;
-
   if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
+    ret = pipewrite(f->pipe, user_src, addr, n, nonblock);
   } else if(f->type == FD_DEVICE){
     if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
       return -1;
-    ret = devsw[f->major].write(1, addr, n);
+    ret = devsw[f->major].write(user_src, addr, n);
   } else if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // the maximum log transaction size (see MAXOPWRITE).
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    int max = MAXOPWRITE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -161,7 +191,7 @@ filewrite(struct file *f, uint64 addr, int n)
 
       begin_op();
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
+      if ((r = writei(f->ip, user_src, addr + i, f->off, n1)) > 0)
         f->off += r;
       iunlock(f->ip);
       end_op();
@@ -172,7 +202,7 @@ filewrite(struct file *f, uint64 addr, int n)
       }
       i += r;
     }
-    ret = (i == n ? n : -1);
+    ret = (i > 0 || n == 0 ? i : -1);
   } else {
     panic("filewrite");
   }
@@ -180,3 +210,162 @@ filewrite(struct file *f, uint64 addr, int n)
   return ret;
 }
 
+// Read from file f.
+// addr is a user virtual address.
+int
+fileread(struct file *f, uint64 addr, int n)
+{
+  if(f->readable == 0)
+    return -1;
+
+  // the copies happen under pipe, console and inode locks.
+  if(n > 0)
+    uvmpagein(addr, n);
+
+  return readfile(f, 1, addr, n, f->nonblock);
+}
+
+// Write to file f.
+// addr is a user virtual address.
+int
+filewrite(struct file *f, uint64 addr, int n)
+{
+  int r;
+
+  if(f->writable == 0)
+    return -1;
+
+  if(n > 0)
+    uvmpagein(addr, n);
+
+  r = writefile(f, 1, addr, n, f->nonblock);
+  // a write to an inode that stopped short failed.
+  if(f->type == FD_INODE && r != n)
+    return -1;
+  return r;
+}
+
+// Move up to n bytes from the inode open as f into pipe pi,
+// straight from the buffer cache. Waits for room in the pipe
+// with no locks held, unless nonblock, then copies what fits
+// under f->ip's lock.
+static int
+splicepipe(struct file *f, struct pipe *pi, int n, int nonblock)
+{
+  int tot = 0, r, eof;
+
+  while(tot < n){
+    if(!nonblock && pipewait(pi) < 0)
+      return tot > 0 ? tot : -1;
+    ilock(f->ip);
+    if(f->off != f->raoff){
+      f->rawin = 0;
+      f->ranext = 0;
+    }
+    if((r = readipipe(f->ip, pi, f->off, n - tot)) > 0){
+      f->off += r;
+      filereadahead(f);
+    }
+    f->raoff = f->off;
+    eof = f->off >= f->ip->size;
+    iunlock(f->ip);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    tot += r;
+    if(eof)
+      break;
+    // r is 0 if the pipe is full, perhaps filled
+    // by another writer since pipewait().
+    if(r == 0 && nonblock)
+      return tot > 0 ? tot : -1;
+  }
+  return tot;
+}
+
+// Move up to n bytes from file in to file out without
+// copying them through user space, for splice().
+// Returns the number of bytes moved, which is less than n
+// at the end of an inode, if in is a pipe or device that
+// has less than that to give right now, or if out stopped
+// taking them. Bytes that out didn't take are read again
+// from an inode; from a pipe or device they are lost, as if
+// copied through read() and write().
+//
+// A file read into a pipe goes straight from the buffer
+// cache into the pipe's pages. Anything else goes through
+// a page of kernel memory: holding the source's buffer while
+// writing to a file or the console could deadlock with the
+// log or with a reader of the same block. Writes from that
+// page wait for room even if out is O_NONBLOCK, since the
+// bytes have already been taken from in.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  char *page;
+  int tot = 0, r, w, m;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(n <= 0)
+    return 0;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return splicepipe(in, out->pipe, n, out->nonblock);
+
+  if((page = kalloc()) == 0)
+    return -1;
+  while(tot < n){
+    m = n - tot;
+    if(m > PGSIZE)
+      m = PGSIZE;
+    if((r = readfile(in, 0, (uint64)page, m, in->nonblock || tot > 0)) <= 0){
+      if(r < 0 && tot == 0)
+        tot = -1;
+      break;
+    }
+    if((w = writefile(out, 0, (uint64)page, r, 0)) > 0)
+      tot += w;
+    if(w != r){
+      if(in->type == FD_INODE){
+        ilock(in->ip);
+        in->off -= r - (w > 0 ? w : 0);
+        iunlock(in->ip);
+      }
+      if(tot == 0)
+        tot = -1;
+      break;
+    }
+    if(r < m)
+      break;
+  }
+  kfree(page);
+  return tot;
+}
+
+// For poll(): which of POLLIN, POLLOUT and POLLHUP hold
+// for f, checked after pollwait()ing on pe for the channel
+// that f's readers or writers sleep on. Reads and writes of
+// an inode never wait.
+int
+filepoll(struct file *f, struct pollent *pe)
+{
+  int r = 0;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, pe);
+  if(f->type == FD_DEVICE){
+    if(f->major < 0 || f->major >= NDEV)
+      return 0;
+    if(devsw[f->major].poll)
+      r = devsw[f->major].poll(pe);
+    else
+      r = POLLIN | POLLOUT;
+  } else if(f->type == FD_INODE){
+    r = POLLIN | POLLOUT;
+  }
+  if(f->readable == 0)
+    r &= ~POLLIN;
+  if(f->writable == 0)
+    r &= ~POLLOUT;
+  return r;
+}
@@ -3,9 +3,13 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: pipe and console reads and writes don't wait
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  uint raoff;        // FD_INODE: where the last read ended
+  uint rawin;        // FD_INODE: readahead window, in blocks
+  uint ranext;       // FD_INODE: first block not yet read ahead
   short major;       // FD_DEVICE
 };
 
@@ -13,11 +17,22 @@ struct file {
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
 
+// The most of a file that one transaction may write: each
+// data block may need its bitmap block too, and besides there
+// are the inode, the double-indirect block and the two
+// indirect blocks below it that a write can straddle, and 2
+// blocks of slop for non-aligned writes.
+#define MAXOPWRITE  (((MAXOPBLOCKS-1-1-2-2) / 2) * BSIZE)
+
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // references that are some process's p->exe
+  struct inode *hnext; // itable hash chain
+  struct inode *prev;  // itable LRU list, while ref is 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -26,13 +41,21 @@ struct inode {
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+
+  uint xlbn;          // extent cache: logical blocks xlbn..
+  uint xpbn;          // are at disk blocks xpbn..,
+  uint xlen;          // for xlen blocks
+  uint goal;          // where balloc() should look for the next block
 };
 
+struct pollent;
+
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(struct pollent*);  // which of POLLIN and POLLOUT hold
 };
 
 extern struct devsw devsw[];
@@ -17,6 +17,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "sleeplock.h"
+#include "slab.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
@@ -37,13 +38,16 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
+static void bsuminit(int);
+
 // Init fs
 void
 fsinit(int dev) {
   readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
+  if(sb.magic != FSMAGIC || sb.ibmapstart == 0)
     panic("invalid file system");
   initlog(dev, &sb);
+  bsuminit(dev);
 }
 
 // Zero a block.
@@ -59,27 +63,99 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// balloc() searches the free bitmap from a goal block, so that
+// a file's blocks end up next to each other on the disk, where
+// readahead and the I/O scheduler can read and write several in
+// one request. A summary of the bitmap, the number of free
+// blocks each bitmap block describes, lets it skip full parts
+// of the bitmap without reading them. The summary is counted
+// when the file system is mounted, and bsum.nfree[i] only
+// changes while bitmap block i's buffer is locked, so it
+// agrees with the cached bitmap; readers that don't hold that
+// lock treat it as a hint.
+
+struct {
+  int n;                       // bitmap blocks
+  uint nfree[FSSIZE/BPB + 1];  // free blocks per bitmap block
+  uint rotor;                  // just after the last block allocated
+} bsum;
+
+// Count the free blocks described by each bitmap block.
+static void
+bsuminit(int dev)
+{
+  struct buf *bp;
+  int i, bi;
+
+  bsum.n = (sb.size + BPB - 1) / BPB;
+  if(bsum.n > NELEM(bsum.nfree))
+    panic("bsuminit: file system too big");
+  for(i = 0; i < bsum.n; i++){
+    bp = bread(dev, sb.bmapstart + i);
+    bsum.nfree[i] = 0;
+    for(bi = 0; bi < BPB && i*BPB + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[i]++;
+    brelse(bp);
+  }
+}
 
-// Allocate a zeroed disk block.
+// Return the first clear bit in [from, to) of bitmap block bp,
+// or -1 if there's none.
+static int
+bitfind(struct buf *bp, int from, int to)
+{
+  int bi;
+
+  for(bi = from; bi < to; bi++){
+    if(bi % 8 == 0 && bi + 8 <= to && bp->data[bi/8] == 0xff){
+      bi += 7;  // skip a full byte
+      continue;
+    }
+    if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+      return bi;
+  }
+  return -1;
+}
+
+// Allocate a zeroed disk block: the first free one at or
+// after goal, wrapping around at the end of the disk. If goal
+// is 0, start after the last block allocated.
 // returns 0 if out of disk space.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal)
 {
-  int b, bi, m;
+  int i, n, bi, lim;
   struct buf *bp;
+  uint b;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.rotor % sb.size;
+
+  // the goal's bitmap block from the goal on, the others,
+  // then the goal's bitmap block again up to the goal.
+  for(i = 0; i <= bsum.n; i++){
+    n = (goal / BPB + i) % bsum.n;
+    if(bsum.nfree[n] == 0)
+      continue;
+    bp = bread(dev, sb.bmapstart + n);
+    lim = min(BPB, sb.size - n*BPB);
+    if(i == 0)
+      bi = bitfind(bp, goal % BPB, lim);
+    else if(i == bsum.n)
+      bi = bitfind(bp, 0, goal % BPB);
+    else
+      bi = bitfind(bp, 0, lim);
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      log_write(bp);
+      bsum.nfree[n]--;
+      brelse(bp);
+      b = n*BPB + bi;
+      bsum.rotor = b + 1;
+      bzero(dev, b);
+      return b;
     }
     brelse(bp);
   }
@@ -101,6 +177,7 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  bsum.nfree[b / BPB]++;
   brelse(bp);
 }
 
@@ -129,18 +206,19 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in table: an entry in the inode table
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a table entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in table: ip->ref tracks the number of
+//   in-memory pointers to a table entry (open files and
+//   current directories). iget() finds or creates a table
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref has fallen to zero stays in the table,
+//   still valid, on an LRU list, in case the inode is wanted
+//   again soon; at most NINODE such entries are kept.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   table entry is only correct when ip->valid is 1.
 //   ilock() reads the inode from
 //   the disk and sets ip->valid, while iput() clears
-//   ip->valid if ip->ref has fallen to zero.
+//   ip->valid if the inode has been freed.
 //
 // * Locked: file system code may only examine and modify
 //   the information in an inode and its content if it
@@ -164,33 +242,114 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
+// The table is a hash table keyed by (dev, inum), and its
+// entries are allocated from a slab, so the number of inodes
+// in use is limited only by memory.
+//
+// The itable.lock spin-lock protects the hash table and the
+// LRU list. Since ip->ref indicates whether an entry is in use,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold itable.lock while using any of those fields.
+// (itable.lock may be held while slaballoc() calls kalloc(),
+// which can call into the buffer cache.)
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
-// dev, and inum.  One must hold ip->lock in order to
+// dev, inum, and the list links.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 127
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slab slab;            // where struct inodes come from
+  struct inode *hash[NIHASH];  // every entry in the table
+  struct inode lru;            // entries with ref 0, most recent first
+  int nlru;
 } itable;
 
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
+  slabinit(&itable.slab, "inode", sizeof(struct inode));
+  itable.lru.next = &itable.lru;
+  itable.lru.prev = &itable.lru;
+}
+
+// Take ip out of the hash table. Caller holds itable.lock.
+static void
+iunhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp; pp = &(*pp)->hnext){
+    if(*pp == ip){
+      *pp = ip->hnext;
+      return;
+    }
   }
+  panic("iunhash");
+}
+
+// Take ip, which has no references, off the LRU list.
+// Caller holds itable.lock.
+static void
+iunlru(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+  itable.nlru--;
 }
 
 static struct inode* iget(uint dev, uint inum);
 
+// The inode bitmap has a bit set for each allocated inode
+// (and for inode 0, which is never used), so ialloc() finds a
+// free inode by probing it from ifreehint, a guess at the
+// lowest free inode number, rather than reading inode blocks.
+static uint ifreehint = 1;
+
+// Find a clear bit for an inode in [from, to) in the inode
+// bitmap, and set it. Returns the inode number, or 0.
+static uint
+imapalloc(uint dev, uint from, uint to)
+{
+  struct buf *bp;
+  uint b;
+  int bi;
+
+  for(b = from; b < to; b = (b/BPB + 1) * BPB){
+    bp = bread(dev, IBBLOCK(b, sb));
+    bi = bitfind(bp, b % BPB, min(BPB, to - b/BPB*BPB));
+    if(bi >= 0){
+      bp->data[bi/8] |= 1 << (bi % 8);
+      log_write(bp);
+      brelse(bp);
+      return b/BPB*BPB + bi;
+    }
+    brelse(bp);
+  }
+  return 0;
+}
+
+// Clear inode inum's bit in the inode bitmap.
+static void
+imapfree(uint dev, uint inum)
+{
+  struct buf *bp;
+  int bi = inum % BPB;
+
+  bp = bread(dev, IBBLOCK(inum, sb));
+  if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+    panic("freeing free inode");
+  bp->data[bi/8] &= ~(1 << (bi % 8));
+  log_write(bp);
+  brelse(bp);
+  if(inum < ifreehint)
+    ifreehint = inum;
+}
+
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode,
@@ -198,24 +357,26 @@ static struct inode* iget(uint dev, uint inum);
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, hint = ifreehint;
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
-    dip = (struct dinode*)bp->data + inum%IPB;
-    if(dip->type == 0){  // a free inode
-      memset(dip, 0, sizeof(*dip));
-      dip->type = type;
-      log_write(bp);   // mark it allocated on the disk
-      brelse(bp);
-      return iget(dev, inum);
-    }
-    brelse(bp);
+  if((inum = imapalloc(dev, hint, sb.ninodes)) == 0 &&
+     (inum = imapalloc(dev, 1, hint)) == 0){
+    printf("ialloc: no inodes\n");
+    return 0;
   }
-  printf("ialloc: no inodes\n");
-  return 0;
+  ifreehint = inum + 1;
+
+  bp = bread(dev, IBLOCK(inum, sb));
+  dip = (struct dinode*)bp->data + inum%IPB;
+  if(dip->type != 0)
+    panic("ialloc: inode map");
+  memset(dip, 0, sizeof(*dip));
+  dip->type = type;
+  log_write(bp);   // mark it allocated on the disk
+  brelse(bp);
+  return iget(dev, inum);
 }
 
 // Copy a modified in-memory inode to disk.
@@ -246,31 +407,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        iunlru(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
-    panic("iget: no inodes");
+  // Make a new entry, or recycle the least recently
+  // used one if memory has run out.
+  if((ip = slaballoc(&itable.slab)) != 0){
+    initsleeplock(&ip->lock, "inode");
+  } else {
+    if(itable.nlru == 0)
+      panic("iget: no inodes");
+    ip = itable.lru.prev;
+    iunlru(ip);
+    iunhash(ip);
+  }
 
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->nexec = 0;
   ip->valid = 0;
+  ip->hnext = itable.hash[IHASH(dev, inum)];
+  itable.hash[IHASH(dev, inum)] = ip;
   release(&itable.lock);
 
   return ip;
@@ -287,6 +456,29 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Take a reference to ip for a process running it, as
+// p->exe; while there are any, writei() won't write ip.
+struct inode*
+iexec(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->ref++;
+  ip->nexec++;
+  release(&itable.lock);
+  return ip;
+}
+
+// Drop a reference taken by iexec().
+// Must be called inside a transaction since it calls iput().
+void
+iputexec(struct inode *ip)
+{
+  acquire(&itable.lock);
+  ip->nexec--;
+  release(&itable.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -310,6 +502,8 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    ip->xlen = 0;
+    ip->goal = 0;
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -347,9 +541,12 @@ iput(struct inode *ip)
 
     release(&itable.lock);
 
+    if(ip->type == T_DIR)
+      dcachepurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
+    imapfree(ip->dev, ip->inum);
     ip->valid = 0;
 
     releasesleep(&ip->lock);
@@ -357,7 +554,26 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(ip->valid){
+      // keep it, in case it's wanted again soon, dropping
+      // the oldest unused entry if there are too many.
+      ip->next = itable.lru.next;
+      ip->prev = &itable.lru;
+      itable.lru.next->prev = ip;
+      itable.lru.next = ip;
+      itable.nlru++;
+      ip = 0;
+      if(itable.nlru > NINODE){
+        ip = itable.lru.prev;
+        iunlru(ip);
+      }
+    }
+    if(ip){
+      iunhash(ip);
+      slabfree(&itable.slab, ip);
+    }
+  }
   release(&itable.lock);
 }
 
@@ -374,7 +590,73 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. Block ip->addrs[NDIRECT+1]
+// lists NINDIRECT more indirect blocks, which list the last
+// NDINDIRECT blocks.
+//
+// Each in-memory inode also caches one extent: the run of
+// logical blocks, contiguous on disk, that the last lookup
+// found. Files are mostly allocated in order, so bmap() can
+// usually map a block without looking at indirect blocks.
+
+// Put the run of contiguous disk blocks a[0], a[1], ... (at
+// most n of them), which hold logical blocks bn, bn+1, ...,
+// in ip's extent cache.
+static void
+xcache(struct inode *ip, uint bn, uint *a, uint n)
+{
+  uint len;
+
+  for(len = 1; len < n && a[len] == a[0] + len; len++)
+    ;
+  ip->xlbn = bn;
+  ip->xpbn = a[0];
+  ip->xlen = len;
+}
+
+// Allocate a block for ip's content, just after the last one
+// allocated for it if that's free.
+static uint
+iballoc(struct inode *ip)
+{
+  uint addr;
+
+  if((addr = balloc(ip->dev, ip->goal)) != 0)
+    ip->goal = addr + 1;
+  return addr;
+}
+
+// Return the block number in slot i of the indirect block
+// whose address is in *ap, allocating the indirect block and
+// the slot's block if need be; 0 if out of disk space.
+// If leaf, the slot holds logical block lbn, and the extent
+// cache is loaded from there.
+static uint
+bslot(struct inode *ip, uint *ap, uint i, int leaf, uint lbn)
+{
+  uint addr, *a;
+  struct buf *bp;
+
+  if((addr = *ap) == 0){
+    addr = iballoc(ip);
+    if(addr == 0)
+      return 0;
+    *ap = addr;
+  }
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    addr = iballoc(ip);
+    if(addr){
+      a[i] = addr;
+      log_write(bp);
+    }
+  }
+  if(addr && leaf)
+    xcache(ip, lbn, &a[i], NINDIRECT - i);
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
@@ -382,52 +664,67 @@ iunlockput(struct inode *ip)
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, ind, lbn = bn;
+
+  if(bn - ip->xlbn < ip->xlen)  // in the cached extent?
+    return ip->xpbn + (bn - ip->xlbn);
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = iballoc(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
     }
+    xcache(ip, bn, &ip->addrs[bn], NDIRECT - bn);
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
-      if(addr == 0)
-        return 0;
-      ip->addrs[NDIRECT] = addr;
-    }
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
-      if(addr){
-        a[bn] = addr;
-        log_write(bp);
-      }
-    }
-    brelse(bp);
-    return addr;
+  if(bn < NINDIRECT)
+    return bslot(ip, &ip->addrs[NDIRECT], bn, 1, lbn);
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // the indirect block, then the block it lists.
+    ind = bslot(ip, &ip->addrs[NDIRECT+1], bn / NINDIRECT, 0, 0);
+    if(ind == 0)
+      return 0;
+    return bslot(ip, &ind, bn % NINDIRECT, 1, lbn);
   }
 
   panic("bmap: out of range");
 }
 
+// Free indirect block addr and the blocks it lists;
+// if depth > 1, those are indirect blocks too.
+static void
+bfreeind(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
+
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      bfreeind(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -437,17 +734,16 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    bfreeind(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bfreeind(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
+  ip->xlen = 0;
   ip->size = 0;
   iupdate(ip);
 }
@@ -464,6 +760,28 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Start reading blocks bn through bn+n-1 of ip into the
+// buffer cache, stopping at the end of the file or when
+// the cache has no buffers to spare. Doesn't wait for the data.
+// Returns the number of blocks started or already cached.
+// Caller must hold ip->lock.
+uint
+readahead(struct inode *ip, uint bn, uint n)
+{
+  uint i, addr;
+
+  if(n > MAXREADAHEAD)
+    n = MAXREADAHEAD;
+  for(i = 0; i < n && bn + i < (ip->size + BSIZE - 1) / BSIZE; i++){
+    if((addr = bmap(ip, bn + i)) == 0)
+      break;
+    if(breadahead(ip->dev, addr) < 0)
+      break;
+  }
+  bkick();
+  return i;
+}
+
 // Read data from inode.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
@@ -479,6 +797,11 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  // get the disk started on the rest of the blocks while
+  // waiting for the first.
+  if(n > 0 && (off + n - 1) / BSIZE > off / BSIZE)
+    readahead(ip, off/BSIZE + 1, (off + n - 1) / BSIZE - off / BSIZE);
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
@@ -495,6 +818,42 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Like readi(), but copy from ip straight out of the buffer
+// cache into pipe pi, stopping when the pipe is full rather
+// than waiting for room. Returns the number of bytes copied,
+// or -1 if the pipe's read end is closed or a block can't
+// be mapped.
+// Caller must hold ip->lock.
+int
+readipipe(struct inode *ip, struct pipe *pi, uint off, uint n)
+{
+  uint tot, m;
+  int r;
+  struct buf *bp;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    uint addr = bmap(ip, off/BSIZE);
+    if(addr == 0)
+      return tot > 0 ? tot : -1;
+    bp = bread(ip->dev, addr);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(pi, (char*)bp->data + (off % BSIZE), m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -512,6 +871,8 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(ip->nexec > 0)
+    return -1;  // a process is paging it in
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     uint addr = bmap(ip, off/BSIZE);
@@ -546,17 +907,455 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// Hashed directories.
+//
+// A directory starts out linear, an array of dirents searched
+// from the start, and stays that way while it fits in one
+// block. When it needs a second, dirlink() turns it into an
+// extendible hash table (see struct dxhead in fs.h): the low
+// depth bits of a name's hash pick an entry of the index in
+// block 0, which names the bucket block holding the entry.
+// Several index entries can share a bucket; a bucket that
+// fills up is split in two, doubling the index first if only
+// one entry points at it. Once block 0's index is as deep as
+// it gets, a bucket that only one of its entries points at
+// is split by giving that entry a sub-index block, which
+// picks buckets by the next hash bits the same way. So a
+// lookup or an insert reads block 0, perhaps a sub-index
+// block, and the bucket.
+//
+// A full bucket is only split if that makes room for the new
+// name, so a split never cascades and an insert fits in a
+// transaction. Otherwise, or once a sub-index is as deep as it
+// gets, the name goes in an overflow block chained to the
+// bucket, which only lookups of names that hash to the bucket
+// read. A later split of a bucket with one overflow block
+// moves the names that belong in the new bucket out of both.
+
+#define DXHEAD(bp)      ((struct dxhead*)(bp)->data + 2)
+#define DXNEXT(bp)      (((struct dxslot*)(bp)->data)->blk[0])
+
+// One level of the index: block 0, whose header is in slot 2,
+// or a sub-index block, whose header is in slot 0. The index
+// entries follow the header, and are picked by the hash bits
+// from shift up.
+struct dxlevel {
+  struct buf *bp;
+  int base;       // slot of the header
+  int shift;
+};
+
+#define LVHEAD(lv)      ((struct dxhead*)(lv)->bp->data + (lv)->base)
+#define LVENT(lv, i)    (&((struct dxslot*)(lv)->bp->data)[(lv)->base + 1 + (i)/DXPERSLOT].blk[(i)%DXPERSLOT])
+
+// FNV-1a; mkfs has a copy, which must agree.
+static uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// If directory dp is hashed, return a locked buf holding its
+// block 0; otherwise return 0.
+static struct buf*
+dxblock0(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxhead *h;
+
+  if(dp->size <= BSIZE)
+    return 0;
+  bp = bread(dp->dev, bmap(dp, 0));
+  h = DXHEAD(bp);
+  if(h->inum == 0 && h->magic == DXMAGIC)
+    return bp;
+  brelse(bp);
+  return 0;
+}
+
+// Find the bucket for name in hashed directory dp, whose
+// block 0 is locked in bp0. Fills in *lv with the level of
+// the index whose entry *pi names the bucket, and returns the
+// bucket's block. Release lv with dxdone().
+static uint
+dxwalk(struct inode *dp, struct buf *bp0, char *name, struct dxlevel *lv, int *pi)
+{
+  uint h = dirhash(name), b;
+
+  lv->bp = bp0;
+  lv->base = 2;
+  lv->shift = 0;
+  *pi = h & ((1 << LVHEAD(lv)->depth) - 1);
+  b = *LVENT(lv, *pi);
+  if(b & DXSUB){
+    lv->bp = bread(dp->dev, bmap(dp, b & ~DXSUB));
+    lv->base = 0;
+    lv->shift = DXMAXDEPTH;
+    *pi = (h >> lv->shift) & ((1 << LVHEAD(lv)->depth) - 1);
+    b = *LVENT(lv, *pi);
+  }
+  return b;
+}
+
+static void
+dxdone(struct dxlevel *lv, struct buf *bp0)
+{
+  if(lv->bp != bp0)
+    brelse(lv->bp);
+}
+
+// Look for name in the bucket at block lb of dp and its
+// overflow chain. Return the offset of its entry, setting
+// *pinum, or -1.
+static int
+dxscan(struct inode *dp, uint lb, char *name, uint *pinum)
+{
+  struct buf *bp;
+  struct dirent *de;
+  int i, off = -1;
+  uint next;
+
+  for(; lb != 0 && off < 0; lb = next){
+    bp = bread(dp->dev, bmap(dp, lb));
+    de = (struct dirent*)bp->data;
+    for(i = 1; i < DPB; i++){
+      if(de[i].inum && namecmp(name, de[i].name) == 0){
+        *pinum = de[i].inum;
+        off = lb*BSIZE + i*sizeof(*de);
+        break;
+      }
+    }
+    next = DXNEXT(bp);
+    brelse(bp);
+  }
+  return off;
+}
+
+// Look for name in hashed directory dp, whose block 0 is
+// locked in bp0. Return the offset of its entry, setting
+// *pinum, or -1 if there's none.
+static int
+dxfind(struct inode *dp, struct buf *bp0, char *name, uint *pinum)
+{
+  struct dirent *de;
+  struct dxlevel lv;
+  int i;
+  uint lb;
+
+  de = (struct dirent*)bp0->data;
+  for(i = 0; i < 2; i++){  // "." and ".."
+    if(de[i].inum && namecmp(name, de[i].name) == 0){
+      *pinum = de[i].inum;
+      return i * sizeof(*de);
+    }
+  }
+
+  lb = dxwalk(dp, bp0, name, &lv, &i);
+  dxdone(&lv, bp0);
+  return dxscan(dp, lb, name, pinum);
+}
+
+// Put (name, inum) in a free slot of the bucket at block lb
+// of dp or its overflow chain. Returns the offset of the new
+// entry, or -1 if they're full, setting *plast to the last
+// block of the chain.
+static int
+dxput(struct inode *dp, uint lb, char *name, uint inum, uint *plast)
+{
+  struct buf *bp;
+  struct dirent *de;
+  int i, off = -1;
+  uint next;
+
+  for(; lb != 0 && off < 0; lb = next){
+    *plast = lb;
+    bp = bread(dp->dev, bmap(dp, lb));
+    de = (struct dirent*)bp->data;
+    for(i = 1; i < DPB; i++){
+      if(de[i].inum == 0){
+        strncpy(de[i].name, name, DIRSIZ);
+        de[i].inum = inum;
+        log_write(bp);
+        off = lb*BSIZE + i*sizeof(*de);
+        break;
+      }
+    }
+    next = DXNEXT(bp);
+    brelse(bp);
+  }
+  return off;
+}
+
+// Append an empty block to dp; returns its number, or 0 if
+// there's no disk space.
+static uint
+dxgrow(struct inode *dp)
+{
+  uint lb = dp->size / BSIZE;
+
+  if(bmap(dp, lb) == 0)
+    return 0;
+  dp->size += BSIZE;
+  iupdate(dp);
+  return lb;
+}
+
+// Move dirent *de to the first free slot at or after *pi in
+// block lb of dp, held in bp, keeping the dentry cache right.
+static void
+dxmoveent(struct inode *dp, struct dirent *de, struct buf *bp, uint lb, int *pi)
+{
+  struct dirent *bde = (struct dirent*)bp->data;
+
+  while(bde[*pi].inum)
+    (*pi)++;
+  bde[*pi] = *de;
+  dcacheenter(dp, de->name, de->inum, lb*BSIZE + *pi*sizeof(*de));
+  memset(de, 0, sizeof(*de));
+}
+
+// Move the entries of dp's bucket from, and of its overflow
+// block if it has one, whose name hash has bit `bit' set into
+// bucket to, which is empty and has room for them all.
+static void
+dxmove(struct inode *dp, uint from, uint to, int bit)
+{
+  struct buf *bp, *tbp;
+  struct dirent *de;
+  int i, t = 1;
+  uint lb, next;
+
+  tbp = bread(dp->dev, bmap(dp, to));
+  for(lb = from; lb != 0; lb = next){
+    bp = bread(dp->dev, bmap(dp, lb));
+    de = (struct dirent*)bp->data;
+    for(i = 1; i < DPB; i++)
+      if(de[i].inum && ((dirhash(de[i].name) >> bit) & 1))
+        dxmoveent(dp, &de[i], tbp, to, &t);
+    next = DXNEXT(bp);
+    log_write(bp);
+    brelse(bp);
+  }
+  log_write(tbp);
+  brelse(tbp);
+}
+
+// The depth of the bucket at block lb in level lv of the
+// index: 1<<(depth - its depth) of lv's entries point at it.
+static int
+dxdepth(struct dxlevel *lv, uint lb)
+{
+  uint i, n = 1 << LVHEAD(lv)->depth, cnt = 0;
+  int depth;
+
+  for(i = 0; i < n; i++)
+    if(*LVENT(lv, i) == lb)
+      cnt++;
+  for(depth = LVHEAD(lv)->depth; cnt > 1; cnt >>= 1)
+    depth--;
+  return depth;
+}
+
+// Would splitting the full bucket at block lb of dp on hash
+// bit `bit' leave room for name in its half? Only a bucket
+// with at most one overflow block is split.
+static int
+dxsplits(struct inode *dp, uint lb, int bit, char *name)
+{
+  struct buf *bp;
+  struct dirent *de;
+  int i, k, n[2] = { 0, 0 }, nb = (dirhash(name) >> bit) & 1;
+
+  for(k = 0; lb != 0; k++){
+    if(k == 2)
+      return 0;
+    bp = bread(dp->dev, bmap(dp, lb));
+    de = (struct dirent*)bp->data;
+    for(i = 1; i < DPB; i++)
+      if(de[i].inum)
+        n[(dirhash(de[i].name) >> bit) & 1]++;
+    lb = DXNEXT(bp);
+    brelse(bp);
+  }
+  n[nb]++;
+  return n[1] <= DPB - 1 && n[0] <= k*(DPB - 1);
+}
+
+// Split the full bucket at block lb of hashed directory dp
+// (block 0 locked in bp0), which entry i of level *lv of the
+// index names and whose depth there is depth, in two. If only
+// that entry names it, first double lv's index, or if that is
+// as big as it gets, give the entry a sub-index block to
+// double instead, updating *lv. Returns 0, or -1 if there's
+// no disk space.
+static int
+dxsplit(struct inode *dp, struct buf *bp0, struct dxlevel *lv, int i, uint lb, int depth)
+{
+  struct dxhead *h = LVHEAD(lv);
+  uint n, nlb, s;
+
+  if(depth == h->depth && h->depth == DXMAXDEPTH){
+    // only in block 0; dxlink() doesn't split a bucket
+    // that deep in a sub-index.
+    if((s = dxgrow(dp)) == 0)
+      return -1;
+    *LVENT(lv, i) = s | DXSUB;
+    log_write(lv->bp);
+    lv->bp = bread(dp->dev, bmap(dp, s));
+    lv->base = 0;
+    lv->shift = DXMAXDEPTH;
+    h = LVHEAD(lv);
+    h->magic = DXMAGIC;
+    h->depth = 0;
+    *LVENT(lv, 0) = lb;
+    depth = 0;
+  }
+
+  n = 1 << h->depth;
+  if(depth == h->depth){
+    for(i = 0; i < n; i++)
+      *LVENT(lv, i + n) = *LVENT(lv, i);
+    h->depth++;
+    n *= 2;
+  }
+  log_write(lv->bp);
+
+  if((nlb = dxgrow(dp)) == 0)
+    return -1;
+
+  // names with hash bit depth set go to the new bucket.
+  for(i = 0; i < n; i++)
+    if(*LVENT(lv, i) == lb && ((i >> depth) & 1))
+      *LVENT(lv, i) = nlb;
+  log_write(lv->bp);
+  dxmove(dp, lb, nlb, lv->shift + depth);
+  return 0;
+}
+
+// Add (name, inum) to hashed directory dp, whose block 0 is
+// locked in bp0. Returns the offset of the new entry, or -1.
+static int
+dxlink(struct inode *dp, struct buf *bp0, char *name, uint inum)
+{
+  struct dxlevel lv;
+  struct buf *bp;
+  uint lb, last, over;
+  int i, off, depth;
+
+  lb = dxwalk(dp, bp0, name, &lv, &i);
+  if((off = dxput(dp, lb, name, inum, &last)) >= 0)
+    goto out;
+
+  depth = dxdepth(&lv, lb);
+  if((lv.shift == 0 || depth < DXMAXDEPTH) &&
+     dxsplits(dp, lb, lv.shift + depth, name)){
+    if(dxsplit(dp, bp0, &lv, i, lb, depth) == 0){
+      dxdone(&lv, bp0);
+      lb = dxwalk(dp, bp0, name, &lv, &i);
+      off = dxput(dp, lb, name, inum, &last);
+    }
+    goto out;
+  }
+
+  // chain an overflow block to the bucket.
+  if((over = dxgrow(dp)) == 0)
+    goto out;
+  bp = bread(dp->dev, bmap(dp, last));
+  DXNEXT(bp) = over;
+  log_write(bp);
+  brelse(bp);
+  off = dxput(dp, over, name, inum, &last);
+
+ out:
+  dxdone(&lv, bp0);
+  return off;
+}
+
+// Turn dp, a linear directory whose one block is full and
+// locked in bp0, into a hashed directory with two buckets.
+static int
+dxconvert(struct inode *dp, struct buf *bp0)
+{
+  struct buf *bp[2];
+  struct dirent *de = (struct dirent*)bp0->data, *bde;
+  struct dxlevel lv = { bp0, 2, 0 };
+  int i, j, n[2] = { 1, 1 };
+
+  for(j = 0; j < 2; j++){
+    if(bmap(dp, 1 + j) == 0){
+      iupdate(dp);
+      return -1;
+    }
+  }
+  for(j = 0; j < 2; j++)
+    bp[j] = bread(dp->dev, bmap(dp, 1 + j));
+
+  // slot 0 of each bucket is its chain's link.
+  for(i = 2; i < DPB; i++){
+    if(de[i].inum == 0)
+      continue;
+    j = dirhash(de[i].name) & 1;
+    bde = (struct dirent*)bp[j]->data + n[j];
+    *bde = de[i];
+    dcacheenter(dp, bde->name, bde->inum, (1 + j)*BSIZE + n[j]*sizeof(*bde));
+    n[j]++;
+  }
+
+  memset(&de[2], 0, BSIZE - 2*sizeof(*de));
+  LVHEAD(&lv)->magic = DXMAGIC;
+  LVHEAD(&lv)->depth = 1;
+  *LVENT(&lv, 0) = 1;
+  *LVENT(&lv, 1) = 2;
+  log_write(bp0);
+  for(j = 0; j < 2; j++){
+    log_write(bp[j]);
+    brelse(bp[j]);
+  }
+
+  dp->size = 3*BSIZE;
+  iupdate(dp);
+  return 0;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
+// The answer comes from the dentry cache if it's there,
+// and goes into it if not.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct dirent de;
+  struct buf *bp;
+  int r;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
+  if((r = dcachelookup(dp, name, poff)) == 0)
+    return 0;
+  if(r > 0)
+    return iget(dp->dev, r);
+
+  if((bp = dxblock0(dp)) != 0){
+    r = dxfind(dp, bp, name, &inum);
+    brelse(bp);
+    if(r < 0){
+      dcacheenter(dp, name, 0, 0);
+      return 0;
+    }
+    if(poff)
+      *poff = r;
+    dcacheenter(dp, name, inum, r);
+    return iget(dp->dev, inum);
+  }
+
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlookup read");
@@ -567,10 +1366,12 @@ dirlookup(struct inode *dp, char *name, uint *poff)
       if(poff)
         *poff = off;
       inum = de.inum;
+      dcacheenter(dp, name, inum, off);
       return iget(dp->dev, inum);
     }
   }
 
+  dcacheenter(dp, name, 0, 0);
   return 0;
 }
 
@@ -582,6 +1383,7 @@ dirlink(struct inode *dp, char *name, uint inum)
   int off;
   struct dirent de;
   struct inode *ip;
+  struct buf *bp;
 
   // Check that name is not present.
   if((ip = dirlookup(dp, name, 0)) != 0){
@@ -589,6 +1391,15 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
+  if((bp = dxblock0(dp)) != 0){
+    off = dxlink(dp, bp, name, inum);
+    brelse(bp);
+    if(off < 0)
+      return -1;
+    dcacheenter(dp, name, inum, off);
+    return 0;
+  }
+
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
     if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
@@ -597,14 +1408,85 @@ dirlink(struct inode *dp, char *name, uint inum)
       break;
   }
 
+  if(off == BSIZE && dp->size == BSIZE){
+    // the directory has outgrown its first block.
+    bp = bread(dp->dev, bmap(dp, 0));
+    if(dxconvert(dp, bp) == 0)
+      off = dxlink(dp, bp, name, inum);
+    else
+      off = -1;
+    brelse(bp);
+    if(off < 0)
+      return -1;
+    dcacheenter(dp, name, inum, off);
+    return 0;
+  }
+
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     return -1;
+  dcacheenter(dp, name, inum, off);
 
   return 0;
 }
 
+// Store in buf[0..n) the absolute path of directory ip, found
+// by walking ".." up to the root and looking for each
+// directory's name in its parent. (The index blocks of a
+// hashed directory start with a zero inum, so a plain scan
+// skips them.) Returns -1 if the path doesn't fit or a
+// directory has been unlinked on the way.
+// Must be called inside a transaction since it calls iput().
+int
+dirpath(struct inode *ip, char *buf, int n)
+{
+  struct inode *dp;
+  struct dirent de;
+  uint off;
+  int i = n - 1, len;
+
+  if(n < 2)
+    return -1;
+  buf[i] = '\0';
+  ip = idup(ip);
+  while(ip->inum != ROOTINO){
+    ilock(ip);
+    dp = dirlookup(ip, "..", 0);
+    iunlock(ip);
+    if(dp == 0 || dp == ip){
+      if(dp)
+        iput(dp);
+      iput(ip);
+      return -1;
+    }
+    ilock(dp);
+    for(off = 0; off < dp->size; off += sizeof(de)){
+      if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirpath read");
+      if(de.inum == ip->inum && namecmp(de.name, ".") && namecmp(de.name, ".."))
+        break;
+    }
+    iunlock(dp);
+    iput(ip);
+    ip = dp;
+    for(len = 0; len < DIRSIZ && de.name[len]; len++)
+      ;
+    if(off >= dp->size || i < len + 1){
+      iput(ip);
+      return -1;
+    }
+    i -= len;
+    memmove(buf + i, de.name, len);
+    buf[--i] = '/';
+  }
+  iput(ip);
+  if(i == n - 1)
+    buf[--i] = '/';
+  memmove(buf, buf + i, n - i);
+  return 0;
+}
+
 // Paths
 
 // Copy the next path element from path into name.
@@ -695,96 +1577,3 @@ nameiparent(char *path, char *name)
 {
   return namex(path, 1, name);
 }
-
-// Get the name of a particular inode in a directory.
-int
-diriname(struct inode *dp, ushort inum, char name[DIRSIZ], ushort *iparent)
-{
-  ilock(dp);
-
-  if (dp->type != T_DIR)
-    panic("diriname not DIR");
-
-  struct dirent de;
-  if (iparent) {
-    // Read second entry ('..', aka parent)
-    readi(dp, 0, (uint64) &de, sizeof(struct dirent), sizeof(struct dirent));
-    *iparent = de.inum;
-  }
-
-  for (uint off = 0; off < dp->size; off += sizeof(de)){
-    if (readi(dp, 0, (uint64) &de, off, sizeof(de)) != sizeof(de))
-      panic("diriname read");
-    if (de.inum == 0)
-      continue;
-    if (de.inum == inum && name) {
-      // Found the inode
-      strncpy(name, de.name, DIRSIZ);
-      iunlockput(dp);
-      return strlen(name);
-    }
-  }
-
-  iunlockput(dp);
-  return -1;
-}
-
-int
-getcwd(char *buf, uint size)
-{
-  struct inode *ip = myproc()->cwd;
-  ilock(ip);
-
-  if(ip->type != T_DIR)
-    panic("getcwd not DIR");
-
-  if (!buf || size <= 1) {
-    iunlock(ip);
-    return -1;
-  }
-
-  if (ip->inum == 1 && size > 1) {
-    buf[0] = '/';
-    buf[1] = '\0';
-    iunlock(ip);
-    return 0;
-  }
-
-  // We copy the path to the *end* of the buffer instead of the beginning, then
-  // work backwards. Start by null terminating the string.
-  buf[size - 1] = '\0';
-  uint bufp = size - 2;
-
-  struct inode *i = iget(ip->dev, ip->inum);
-
-  ushort iparent;
-  ushort last_parent = ip->inum;
-  ushort icurrent = ip->inum;
-  char name[DIRSIZ];
-  iunlock(ip);
-
-  // Starting with the CWD inode, go up one level (..), read that directory, and
-  // search for the CWD inode in it. Repeat the process until we reach /.
-  while (icurrent != 1 && diriname(i, icurrent, name, &iparent) != -1) {
-    if (icurrent != last_parent) {
-      // We found another path element. Add it to the string.
-      int len = strlen(name);
-      if (len < bufp) {
-        bufp -= len;
-        memmove(buf + bufp, name, len);
-        buf[--bufp] = '/';
-      } else {
-        // No more space to store the path.
-        break;
-      }
-    }
-    i = iget(ip->dev, iparent);
-    icurrent = last_parent;
-    last_parent = iparent;
-  }
-
-  // If we didn't use the entire buffer, slide the string over to the beginning.
-  memmove(buf, buf + bufp, size - bufp);
-
-  return 0;
-}
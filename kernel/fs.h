@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                          inode bit map | free bit map | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -20,13 +20,15 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint ibmapstart;   // Block number of first inode map block
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,7 +37,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -50,6 +52,9 @@ struct dinode {
 // Block of free map containing bit for block b
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
+// Block of inode map containing bit for inode i
+#define IBBLOCK(i, sb) ((i)/BPB + sb.ibmapstart)
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
@@ -58,3 +63,35 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// Directory entries per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// A directory that outgrows one block becomes a hashed
+// directory (see kernel/fs.c). Block 0 holds ".", "..", a
+// struct dxhead and the index, 1<<depth block numbers packed
+// DXPERSLOT to a struct dxslot. Each names a bucket or, with
+// DXSUB set, a sub-index block, which holds a struct dxhead
+// and an index of its own for the next DXMAXDEPTH hash bits.
+// Every other block is a bucket or an overflow block chained
+// to one: its first struct dxslot holds the number of the next
+// block in the chain, and dirents follow. The
+// headers and index slots start with a zero inum, so programs
+// reading the directory skip them.
+#define DXMAGIC    0x7864      // "dx"
+#define DXMAXDEPTH 7           // at most 128 entries per index block
+#define DXPERSLOT  3
+#define DXSUB      0x80000000  // index entry names a sub-index block
+
+struct dxhead {
+  ushort inum;    // 0
+  ushort magic;   // DXMAGIC
+  uint depth;     // the index has 1<<depth entries
+  uint pad[2];
+};
+
+struct dxslot {
+  ushort inum;    // 0
+  ushort pad;
+  uint blk[DXPERSLOT];
+};
+
@@ -0,0 +1,151 @@
+// Disk I/O scheduler.
+//
+// Sits between the buffer cache and the disk driver.
+// iostart() queues a transfer of a buffer, sorted by block
+// number; iokick() sends the queued transfers to the driver
+// in one-way elevator (C-SCAN) order, ascending from where
+// the previous request ended and then wrapping around to the
+// lowest block. Queued transfers of consecutive blocks in the
+// same direction go to the driver as a single request of up
+// to MAXSEG blocks.
+//
+// A transfer usually goes to or from the buffer's own block,
+// but iostartat() can send a buffer's data elsewhere; the log
+// uses it to write cached blocks straight into the log.
+//
+// Transfers that don't fit in the driver's ring stay queued
+// until virtio_disk_intr() has freed some descriptors and
+// calls iokick() again.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+#include "kstat.h"
+
+struct {
+  struct spinlock lock;
+  struct buf *head;  // queued transfers, sorted by (dev, blockno)
+  uint pos;          // the elevator serves blocks >= pos next
+
+  uint64 nblock;     // blocks sent to the driver
+  uint64 nreq;       // requests they were sent in
+} ioq;
+
+void
+ioinit(void)
+{
+  initlock(&ioq.lock, "ioq");
+}
+
+// does a come before b on the disk?
+static int
+before(struct buf *a, struct buf *b)
+{
+  return a->dev < b->dev || (a->dev == b->dev && a->ioblock < b->ioblock);
+}
+
+// can b go in the same request as a, right after it?
+static int
+follows(struct buf *a, struct buf *b)
+{
+  return b->dev == a->dev && b->ioblock == a->ioblock + 1 &&
+         b->iowrite == a->iowrite;
+}
+
+// Queue a transfer of locked buffer b to or from the disk.
+// If async, bdone(b) is called when it has finished;
+// otherwise the caller must wait for it with iowait().
+// Nothing is sent to the disk until iokick().
+void
+iostart(struct buf *b, int write, int async)
+{
+  iostartat(b, b->blockno, write, async);
+}
+
+// Like iostart(), but transfer b->data to or from block
+// blockno of b's device rather than b's own block.
+void
+iostartat(struct buf *b, uint blockno, int write, int async)
+{
+  struct buf **pp;
+
+  acquire(&ioq.lock);
+  b->disk = 1;
+  b->ioblock = blockno;
+  b->iowrite = write;
+  b->ioasync = async;
+  for(pp = &ioq.head; *pp && before(*pp, b); pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+  release(&ioq.lock);
+}
+
+// Send as many queued transfers to the disk as it will take.
+void
+iokick(void)
+{
+  struct buf **pp, *b, *last;
+  int n;
+
+  acquire(&ioq.lock);
+  while(ioq.head){
+    // the first transfer at or after the elevator's
+    // position, or else the lowest.
+    for(pp = &ioq.head; *pp && (*pp)->ioblock < ioq.pos; pp = &(*pp)->qnext)
+      ;
+    if(*pp == 0)
+      pp = &ioq.head;
+
+    // take it and the transfers that continue it.
+    b = last = *pp;
+    for(n = 1; n < MAXSEG && last->qnext && follows(last, last->qnext); n++)
+      last = last->qnext;
+    *pp = last->qnext;
+    last->qnext = 0;
+
+    if(virtio_disk_start(b, b->iowrite) < 0){
+      // the driver is full; put them back.
+      last->qnext = *pp;
+      *pp = b;
+      break;
+    }
+    ioq.pos = last->ioblock + 1;
+    ioq.nblock += n;
+    ioq.nreq++;
+  }
+  release(&ioq.lock);
+
+  virtio_disk_kick();
+}
+
+// Wait for the transfer of b queued by iostart() to finish.
+void
+iowait(struct buf *b)
+{
+  virtio_disk_wait(b);
+}
+
+// Transfer locked buffer b to or from the disk, and wait for it.
+void
+iorw(struct buf *b, int write)
+{
+  iostart(b, write, 0);
+  iokick();
+  iowait(b);
+}
+
+// Copy out the I/O scheduler counters.
+void
+iostat(struct diskstat *st)
+{
+  acquire(&ioq.lock);
+  st->nblock = ioq.nblock;
+  st->nreq = ioq.nreq;
+  release(&ioq.lock);
+}
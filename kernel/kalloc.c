@@ -1,6 +1,20 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU keeps its own free list, protected by its own
+// lock, so that kalloc() and kfree() on different harts
+// don't contend. kfree() returns a page to the freeing
+// CPU's list; when a CPU's list runs dry, kalloc() steals
+// a batch of pages from another CPU's list.
+//
+// When no CPU has a free page left, kalloc() asks the
+// buffer cache to give some back (see bshrink()).
+//
+// Pages can be shared (e.g. by copy-on-write fork), so each
+// physical page has a reference count. kalloc() returns a
+// page with one reference, kaddref() adds one, and kfree()
+// drops one and only frees the page when none remain.
 
 #include "types.h"
 #include "param.h"
@@ -8,25 +22,43 @@
 #include "spinlock.h"
 #include "riscv.h"
 #include "defs.h"
+#include "kstat.h"
 
 void freerange(void *pa_start, void *pa_end);
 
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// max pages moved from another CPU's list by one steal.
+#define NSTEAL 32
+
 struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  uint64 nfree;   // pages on freelist
+  uint64 nhit;    // kalloc()s satisfied from this CPU's list
+  uint64 nsteal;  // kalloc()s that had to steal from another CPU
+  uint64 nfail;   // kalloc()s that found no free page anywhere
+};
+
+struct kmem kmem[NCPU];
+
+// reference counts for the pages between KERNBASE and PHYSTOP,
+// updated with atomic instructions rather than under a lock.
+#define PA2IDX(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int pgref[PA2IDX(PHYSTOP)];
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+  // all pages start out on the booting CPU's list;
+  // the other CPUs steal them as they need them.
   freerange(end, (void*)PHYSTOP);
 }
 
@@ -35,31 +67,88 @@ freerange(void *pa_start, void *pa_end)
 {
   char *p;
   p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE){
+    pgref[PA2IDX(p)] = 1;
     kfree(p);
+  }
 }
 
-// Free the page of physical memory pointed at by pa,
-// which normally should have been returned by a
+// Drop a reference to the page of physical memory pointed
+// at by pa, which normally should have been returned by a
 // call to kalloc().  (The exception is when
 // initializing the allocator; see kinit above.)
+// The page is freed when its last reference goes away.
 void
 kfree(void *pa)
 {
   struct run *r;
+  struct kmem *km;
+  int ref;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  ref = __sync_sub_and_fetch(&pgref[PA2IDX(pa)], 1);
+  if(ref < 0)
+    panic("kfree: ref");
+  if(ref > 0)
+    return;
+
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
 
   r = (struct run*)pa;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  km = &kmem[cpuid()];
+  acquire(&km->lock);
+  r->next = km->freelist;
+  km->freelist = r;
+  km->nfree++;
+  release(&km->lock);
+  pop_off();
+}
+
+// Move up to NSTEAL pages from another CPU's free list
+// to km, the calling CPU's list. Returns the number of
+// pages moved. Only one kmem lock is held at a time,
+// so two CPUs stealing from each other can't deadlock.
+static int
+ksteal(struct kmem *km)
+{
+  struct kmem *victim;
+  struct run *first, *last;
+  int n;
+
+  for(victim = kmem; victim < &kmem[NCPU]; victim++){
+    if(victim == km || victim->nfree == 0)  // racy peek; rechecked below
+      continue;
+
+    acquire(&victim->lock);
+    first = last = victim->freelist;
+    n = 0;
+    if(first){
+      // take half of the victim's pages, at most NSTEAL.
+      n = 1;
+      while(n < NSTEAL && n < (victim->nfree + 1) / 2 && last->next){
+        last = last->next;
+        n++;
+      }
+      victim->freelist = last->next;
+      victim->nfree -= n;
+    }
+    release(&victim->lock);
+
+    if(n > 0){
+      acquire(&km->lock);
+      last->next = km->freelist;
+      km->freelist = first;
+      km->nfree += n;
+      release(&km->lock);
+      return n;
+    }
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -69,14 +158,90 @@ void *
 kalloc(void)
 {
   struct run *r;
+  struct kmem *km;
+  int stolen = 0, shrunk = 0;
+
+  push_off();
+  km = &kmem[cpuid()];
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  for(;;){
+    acquire(&km->lock);
+    r = km->freelist;
+    if(r){
+      km->freelist = r->next;
+      km->nfree--;
+      if(stolen)
+        km->nsteal++;
+      else
+        km->nhit++;
+    }
+    release(&km->lock);
 
-  if(r)
+    if(r)
+      break;
+    if(ksteal(km) > 0){
+      stolen = 1;
+    } else {
+      // bshrink() kfree()s onto this CPU's list.
+      if(shrunk || bshrink(NSTEAL) == 0)
+        break;
+      shrunk = 1;
+    }
+  }
+
+  if(r == 0){
+    acquire(&km->lock);
+    km->nfail++;
+    release(&km->lock);
+  }
+  pop_off();
+
+  if(r){
+    pgref[PA2IDX(r)] = 1;
     memset((char*)r, 5, PGSIZE); // fill with junk
+  }
   return (void*)r;
 }
+
+// Add a reference to an allocated page.
+void
+kaddref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kaddref");
+  if(__sync_fetch_and_add(&pgref[PA2IDX(pa)], 1) < 1)
+    panic("kaddref: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+krefcnt(void *pa)
+{
+  return pgref[PA2IDX(pa)];
+}
+
+// Return the number of free pages, summed over all
+// CPUs' lists without locking them.
+uint64
+kfreepages(void)
+{
+  uint64 n = 0;
+
+  for(int i = 0; i < NCPU; i++)
+    n += kmem[i].nfree;
+  return n;
+}
+
+// Copy out the per-CPU allocator counters.
+void
+kallocstat(struct kmemstat *st)
+{
+  for(int i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    st->cpu[i].nfree = kmem[i].nfree;
+    st->cpu[i].nhit = kmem[i].nhit;
+    st->cpu[i].nsteal = kmem[i].nsteal;
+    st->cpu[i].nfail = kmem[i].nfail;
+    release(&kmem[i].lock);
+  }
+}
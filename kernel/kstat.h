@@ -0,0 +1,53 @@
+// Kernel statistics returned by the kstat() system call.
+// Both the kernel and user programs use this header file;
+// user programs must include kernel/param.h first for NCPU.
+
+#define KSTAT_KMEM    1   // struct kmemstat
+#define KSTAT_SCHED   2   // struct schedstat
+#define KSTAT_BCACHE  3   // struct bcachestat
+#define KSTAT_DISK    4   // struct diskstat
+#define KSTAT_DCACHE  5   // struct dcachestat
+
+// physical page allocator, one entry per CPU.
+struct kmemstat {
+  struct {
+    uint64 nfree;   // pages on this CPU's free list
+    uint64 nhit;    // allocations satisfied from the local list
+    uint64 nsteal;  // allocations that stole from another CPU
+    uint64 nfail;   // allocations that found no free page
+  } cpu[NCPU];
+};
+
+// scheduler run queues, one entry per CPU.
+struct schedstat {
+  struct {
+    uint64 len;     // processes waiting on this CPU's run queue
+    uint64 nrun;    // processes this CPU has switched to
+    uint64 nsteal;  // of those, taken from another CPU's queue
+    uint64 idle;    // time spent idle, in timer ticks (10 MHz on qemu)
+  } cpu[NCPU];
+};
+
+// disk block cache.
+struct bcachestat {
+  uint64 nbuf;      // buffers in the cache
+  uint64 target;    // buffers the cache may grow to
+  uint64 nhit;      // lookups that found the block cached
+  uint64 nmiss;     // lookups that had to recycle a buffer
+  uint64 nevict;    // misses that displaced another cached block
+  uint64 nshrink;   // buffers freed because memory ran out
+  uint64 nreadahead; // blocks read ahead of a sequential reader
+};
+
+// disk I/O scheduler.
+struct diskstat {
+  uint64 nblock;    // blocks transferred
+  uint64 nreq;      // disk requests, after merging adjacent blocks
+};
+
+// directory entry cache.
+struct dcachestat {
+  uint64 nhit;      // lookups answered with an inode
+  uint64 nneg;      // lookups answered "no such name"
+  uint64 nmiss;     // lookups that had to read the directory
+};
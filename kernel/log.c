@@ -19,7 +19,17 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// asks for a commit and sleeps until it's done.
+//
+// Commits are made by a kernel thread, the log daemon,
+// never by end_op(), so a system call returns as soon as its
+// updates are in the in-memory transaction, and one commit
+// covers every system call since the last (group commit).
+// The daemon commits when asked to (by a full log, or by
+// fsync(), which waits for the commit), and every
+// COMMITTICKS clock ticks while the log is non-empty.
+// Once a commit has been asked for, begin_op() holds new
+// system calls back until it's done, so that it can start.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,7 +38,9 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+
+// commit at least this often, in clock ticks.
+#define COMMITTICKS 10
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -43,6 +55,9 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int want;        // a commit has been asked for.
+  uint seq;        // number of commits made.
+  uint lastcommit; // ticks at the last commit.
   int dev;
   struct logheader lh;
 };
@@ -50,6 +65,7 @@ struct log log;
 
 static void recover_from_log(void);
 static void commit();
+static void logdaemon(void);
 
 void
 initlog(int dev, struct superblock *sb)
@@ -62,23 +78,37 @@ initlog(int dev, struct superblock *sb)
   log.size = sb->nlog;
   log.dev = dev;
   recover_from_log();
+  kthread(logdaemon, "logd");
 }
 
-// Copy committed blocks from log to their home location
+// Copy committed blocks from log to their home location.
+// The writes go to the disk MAXSEG at a time, so that the
+// I/O scheduler can sort them and merge neighbours.
+// Outside recovery the blocks are still pinned in the cache,
+// so they are written from there and the log isn't read.
 static void
 install_trans(int recovering)
 {
-  int tail;
+  struct buf *dbufs[MAXSEG];
+  int tail, n = 0;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
     struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+    if(recovering){
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    dbufs[n++] = dbuf;
+    if(n == MAXSEG || tail == log.lh.n - 1){
+      bwritev(dbufs, n);  // write dst to disk
+      while(n > 0){
+        dbuf = dbufs[--n];
+        if(recovering == 0)
+          bunpin(dbuf);
+        brelse(dbuf);
+      }
+    }
   }
 }
 
@@ -122,16 +152,27 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+// ask the log daemon for a commit.
+// caller must hold log.lock.
+static void
+requestcommit(void)
+{
+  log.want = 1;
+  if(log.outstanding == 0)
+    wakeup(&log.want);
+}
+
 // called at the start of each FS system call.
 void
 begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.committing || log.want){
       sleep(&log, &log.lock);
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
       // this op might exhaust log space; wait for commit.
+      requestcommit();
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -142,19 +183,17 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// the changes will be committed later, by logdaemon().
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  if(log.outstanding == 0 && log.want){
+    // the commit was waiting for this operation.
+    wakeup(&log.want);
   } else {
     // begin_op() may be waiting for log space,
     // and decrementing log.outstanding has decreased
@@ -162,31 +201,92 @@ end_op(void)
     wakeup(&log);
   }
   release(&log.lock);
+}
+
+// The log daemon: a kernel thread that makes every commit.
+static void
+logdaemon(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    while(!(log.want && log.outstanding == 0))
+      sleep(&log.want, &log.lock);
+
+    if(log.lh.n == 0){
+      // nothing happened since the last commit.
+      log.want = 0;
+      wakeup(&log);
+      continue;
+    }
 
-  if(do_commit){
+    log.committing = 1;
+    log.want = 0;
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
+    release(&log.lock);
     commit();
     acquire(&log.lock);
     log.committing = 0;
+    log.seq++;
+    log.lastcommit = ticks;
     wakeup(&log);
+  }
+}
+
+// Called by clockintr() on every tick: ask for a commit
+// if the log has held changes for COMMITTICKS ticks.
+void
+log_tick(void)
+{
+  acquire(&log.lock);
+  if(log.lh.n > 0 && !log.want && !log.committing &&
+     ticks - log.lastcommit >= COMMITTICKS)
+    requestcommit();
+  release(&log.lock);
+}
+
+// Wait until all FS system calls that have finished are
+// on disk, forcing a commit if they haven't been yet.
+void
+log_sync(void)
+{
+  uint target;
+
+  acquire(&log.lock);
+  if(log.lh.n == 0 && !log.committing){
     release(&log.lock);
+    return;
   }
+  // the commit in progress, if any, has everything that
+  // finished before it started; otherwise the next does.
+  target = log.seq + 1;
+  if(!log.committing)
+    requestcommit();
+  while((int)(log.seq - target) < 0)
+    sleep(&log, &log.lock);
+  release(&log.lock);
 }
 
-// Copy modified blocks from cache to log.
+// Write modified blocks from the cache to the log. Each
+// cached block is written straight into its log slot, with
+// no copy and no buffer for the slot; the slots are
+// consecutive, so each batch of MAXSEG of them goes to the
+// disk as a single request. (Only recovery reads log slots
+// through the cache, so the copies it left there are unused.)
 static void
 write_log(void)
 {
-  int tail;
+  struct buf *bs[MAXSEG];
+  int tail, n = 0;
 
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+    bs[n++] = bread(log.dev, log.lh.block[tail]); // cache block
+    if(n == MAXSEG || tail == log.lh.n - 1){
+      // slots tail-n+1 .. tail, just after the header.
+      bwriteat(bs, n, log.start+1+tail-n+1);
+      while(n > 0)
+        brelse(bs[--n]);
+    }
   }
 }
 
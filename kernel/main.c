@@ -25,8 +25,11 @@ main()
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
+    ioinit();        // disk request queue
     iinit();         // inode table
+    dcacheinit();    // directory entry cache
     fileinit();      // file table
+    pipeinit();      // pipe buffers
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
     __sync_synchronize();
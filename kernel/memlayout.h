@@ -65,6 +65,8 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   URING (p->ring, if uring_setup() has been called)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define URING (TRAPFRAME - PGSIZE)
@@ -0,0 +1,434 @@
+// Memory-mapped files.
+//
+// mmap() records a struct vma in the process and maps
+// nothing; vmfault() calls mmapfault() to read each page
+// from the file through the buffer cache the first time the
+// process touches it. Pages past the end of the file read
+// as zeros.
+//
+// A MAP_PRIVATE page is the process's own from then on, and
+// is shared copy-on-write with children like the heap.
+// A MAP_SHARED page is mapped read-only until the process
+// writes it; the write fault makes it writable and marks it
+// PTE_DIRTY, and munmap(), exit() and exec() write dirty
+// pages back to the file, never past its end. A MAP_SHARED
+// vma's pages are kept in a struct vmpages, which a fork()ed
+// child shares, so parent and child see the same page even
+// if neither touched it before the fork. Two processes that
+// mmap() the same file get their own copies, though, which
+// only meet in the file.
+//
+// Mappings are placed top down, each just below the lowest
+// one, starting below URING; growproc() keeps the heap below
+// them all.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "mman.h"
+
+// The pages of a MAP_SHARED vma and of its copies in forked
+// relatives, each faulted in from the file by whichever of
+// them touches it first. One page, so a MAP_SHARED mapping
+// is at most NVMPAGES pages long.
+struct vmpages {
+  struct spinlock lock;
+  int ref;        // vmas using this
+  uint base;      // file page number of pg[0]
+  uint pg[];      // physical page numbers, or 0
+};
+
+#define NVMPAGES ((PGSIZE - sizeof(struct vmpages)) / sizeof(uint))
+
+// The lowest address mapped by p's vmas, or URING if none:
+// the top of the space growproc() may grow the heap into.
+uint64
+mmapbase(struct proc *p)
+{
+  uint64 base = URING;
+
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va && v->va < base)
+      base = v->va;
+  return base;
+}
+
+// Return p's vma that contains va, or 0.
+static struct vma*
+findvma(struct proc *p, uint64 va)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va && va >= v->va && va < v->va + v->len)
+      return v;
+  return 0;
+}
+
+// Drop a reference to vp, freeing it and its pages with the
+// last one.
+static void
+vmpagesput(struct vmpages *vp)
+{
+  int ref;
+
+  acquire(&vp->lock);
+  ref = --vp->ref;
+  release(&vp->lock);
+  if(ref > 0)
+    return;
+  for(int i = 0; i < NVMPAGES; i++)
+    if(vp->pg[i])
+      kfree((void*)((uint64)vp->pg[i] << PGSHIFT));
+  kfree(vp);
+}
+
+// Release v and the file and pages it holds.
+static void
+vmafree(struct vma *v)
+{
+  fileclose(v->f);
+  if(v->pages)
+    vmpagesput(v->pages);
+  v->va = 0;
+  v->f = 0;
+  v->pages = 0;
+}
+
+// Read the page at va in v from the file into a new page.
+// Returns it, or 0 if memory ran out.
+static char*
+filepage(struct vma *v, uint64 va)
+{
+  char *mem;
+
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  ilock(v->f->ip);
+  readi(v->f->ip, 0, (uint64)mem, v->off + (va - v->va), PGSIZE);
+  iunlock(v->f->ip);
+  return mem;
+}
+
+// Return, with a reference for the caller, the shared page
+// at va in MAP_SHARED vma v, reading it from the file if no
+// process sharing it has yet. Returns 0 if memory ran out.
+static char*
+sharedpage(struct vma *v, uint64 va)
+{
+  struct vmpages *vp = v->pages;
+  uint i = (v->off + (va - v->va)) / PGSIZE - vp->base;
+  char *mem;
+
+  acquire(&vp->lock);
+  if(vp->pg[i] == 0){
+    // read it without the lock; another process may race
+    // to do the same, and the loser frees its copy.
+    release(&vp->lock);
+    if((mem = filepage(v, va)) == 0)
+      return 0;
+    acquire(&vp->lock);
+    if(vp->pg[i] == 0)
+      vp->pg[i] = (uint64)mem >> PGSHIFT;
+    else
+      kfree(mem);
+  }
+  mem = (char*)((uint64)vp->pg[i] << PGSHIFT);
+  kaddref(mem);
+  release(&vp->lock);
+  return mem;
+}
+
+// Handle a page fault at va, above p->sz, in p's page table.
+// Returns 0 if the access can now be retried, -1 if va is
+// in no vma, the vma doesn't allow the access, or memory
+// ran out. Reads the file, so may sleep; see uvmpagein().
+int
+mmapfault(struct proc *p, uint64 va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  char *mem;
+  int perm = PTE_R | PTE_U;
+
+  va = PGROUNDDOWN(va);
+  if((v = findvma(p, va)) == 0)
+    return -1;
+  if(write && (v->prot & PROT_WRITE) == 0)
+    return -1;
+  if((v->prot & (PROT_READ|PROT_WRITE)) == 0)
+    return -1;
+
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    // first write to a MAP_SHARED page.
+    if(!write || v->flags != MAP_SHARED || (*pte & PTE_W))
+      return -1;
+    *pte |= PTE_W | PTE_DIRTY;
+    return 0;
+  }
+
+  if(v->flags == MAP_SHARED)
+    mem = sharedpage(v, va);
+  else
+    mem = filepage(v, va);
+  if(mem == 0)
+    return -1;
+
+  if(v->prot & PROT_WRITE){
+    if(v->flags == MAP_PRIVATE)
+      perm |= PTE_W;
+    else if(write)
+      perm |= PTE_W | PTE_DIRTY;
+  }
+  if(mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the pages of [va, va+len) that lie in p's vmas,
+// as uvmpagein() does for program segments.
+void
+mmappagein(struct proc *p, uint64 va, uint64 len)
+{
+  pte_t *pte;
+  uint64 a, end;
+
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->va == 0 || va >= v->va + v->len || va + len <= v->va)
+      continue;
+    a = PGROUNDDOWN(va) > v->va ? PGROUNDDOWN(va) : v->va;
+    end = va + len < v->va + v->len ? va + len : v->va + v->len;
+    for(; a < end; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        mmapfault(p, a, 0);
+    }
+  }
+}
+
+// Write the page mem, mapped at va in v, back to v's file,
+// up to the end of the file.
+static void
+writeback(struct vma *v, uint64 va, char *mem)
+{
+  struct inode *ip = v->f->ip;
+  uint off = v->off + (va - v->va);
+  int max = MAXOPWRITE;
+  int i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    n = PGSIZE - i;
+    if(n > max)
+      n = max;
+    begin_op();
+    ilock(ip);
+    if(off + i >= ip->size){
+      iunlock(ip);
+      end_op();
+      break;
+    }
+    if(n > ip->size - (off + i))
+      n = ip->size - (off + i);
+    writei(ip, 0, (uint64)(mem + i), off + i, n);
+    iunlock(ip);
+    end_op();
+  }
+}
+
+// Write back the dirty pages of [va, va+len) in v and
+// unmap them from pagetable.
+static void
+vmaunmap(pagetable_t pagetable, struct vma *v, uint64 va, uint64 len)
+{
+  pte_t *pte;
+  uint64 a;
+
+  for(a = va; a < va + len; a += PGSIZE){
+    pte = walk(pagetable, a, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0)
+      continue;
+    if(v->flags == MAP_SHARED && (*pte & PTE_DIRTY))
+      writeback(v, a, (char*)PTE2PA(*pte));
+    uvmunmap(pagetable, a, 1, 1);
+  }
+}
+
+// Unmap all of p's vmas from pagetable, which is p's
+// page table or, in exec(), the one it is replacing.
+void
+mmapclear(struct proc *p, pagetable_t pagetable)
+{
+  for(struct vma *v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->va == 0)
+      continue;
+    vmaunmap(pagetable, v, v->va, v->len);
+    vmafree(v);
+  }
+}
+
+// Give np, a new child of p, p's vmas: MAP_SHARED ones share
+// their struct vmpages, from which the child faults pages in,
+// and MAP_PRIVATE pages already faulted in are shared
+// copy-on-write.
+// Returns 0, or -1 having mapped nothing if memory runs out.
+int
+mmapfork(struct proc *p, struct proc *np)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 a, pa;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->va == 0 || v->flags == MAP_SHARED)
+      continue;
+    for(a = v->va; a < v->va + v->len; a += PGSIZE){
+      if((pte = walk(p->pagetable, a, 0)) == 0 || (*pte & PTE_V) == 0)
+        continue;
+      if(*pte & PTE_W)
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      if(mappages(np->pagetable, a, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+        goto bad;
+      kaddref((void*)pa);
+    }
+  }
+  for(int i = 0; i < NVMA; i++){
+    v = &np->vma[i];
+    *v = p->vma[i];
+    if(v->va == 0)
+      continue;
+    filedup(v->f);
+    if(v->pages){
+      acquire(&v->pages->lock);
+      v->pages->ref++;
+      release(&v->pages->lock);
+    }
+  }
+  return 0;
+
+ bad:
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va)
+      uvmunmap(np->pagetable, v->va, v->len / PGSIZE, 1);
+  return -1;
+}
+
+// Map len bytes of the file open as fd, from offset off,
+// which must be a multiple of PGSIZE, with protection prot
+// and flags MAP_SHARED, for at most NVMPAGES pages, or
+// MAP_PRIVATE.
+// Returns the address, or -1.
+uint64
+sys_mmap(void)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  struct vma *v, *free = 0;
+  struct vmpages *vp = 0;
+  int fd, off, len, prot, flags;
+  uint64 va;
+
+  argint(0, &fd);
+  argint(1, &off);
+  argint(2, &len);
+  argint(3, &prot);
+  argint(4, &flags);
+  if(fd < 0 || fd >= NOFILE || (f = p->ofile[fd]) == 0)
+    return -1;
+  if(f->type != FD_INODE || f->readable == 0)
+    return -1;
+  if(off < 0 || off % PGSIZE != 0 || len <= 0)
+    return -1;
+  if(flags != MAP_SHARED && flags != MAP_PRIVATE)
+    return -1;
+  if(flags == MAP_SHARED && (prot & PROT_WRITE) && f->writable == 0)
+    return -1;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->va == 0)
+      free = v;
+  if(free == 0)
+    return -1;
+  va = mmapbase(p) - PGROUNDUP(len);
+  if(PGROUNDUP(len) > mmapbase(p) || va < PGROUNDUP(p->sz))
+    return -1;
+  if(flags == MAP_SHARED){
+    if(PGROUNDUP(len) / PGSIZE > NVMPAGES || (vp = kalloc()) == 0)
+      return -1;
+    memset(vp, 0, PGSIZE);
+    initlock(&vp->lock, "vmpages");
+    vp->ref = 1;
+    vp->base = off / PGSIZE;
+  }
+
+  free->va = va;
+  free->len = PGROUNDUP(len);
+  free->off = off;
+  free->prot = prot;
+  free->flags = flags;
+  free->f = filedup(f);
+  free->pages = vp;
+  return va;
+}
+
+// Free the shared pages of [va, va+len) in v, unless a
+// forked relative's copy of v may still use them.
+static void
+vmpagesdrop(struct vma *v, uint64 va, uint64 len)
+{
+  struct vmpages *vp = v->pages;
+  uint i = (v->off + (va - v->va)) / PGSIZE - vp->base;
+
+  acquire(&vp->lock);
+  if(vp->ref == 1){
+    for(; len > 0; len -= PGSIZE, i++){
+      if(vp->pg[i])
+        kfree((void*)((uint64)vp->pg[i] << PGSHIFT));
+      vp->pg[i] = 0;
+    }
+  }
+  release(&vp->lock);
+}
+
+// Unmap [addr, addr+len), which must be the whole of a
+// mapping or cover its start or its end, writing dirty
+// MAP_SHARED pages back to the file.
+uint64
+sys_munmap(void)
+{
+  struct proc *p = myproc();
+  struct vma *v;
+  uint64 addr;
+  int len;
+
+  argaddr(0, &addr);
+  argint(1, &len);
+  if(addr % PGSIZE != 0 || len <= 0 || (v = findvma(p, addr)) == 0)
+    return -1;
+  len = PGROUNDUP(len);
+  if(addr + len > v->va + v->len)
+    return -1;
+  if(addr != v->va && addr + len != v->va + v->len)
+    return -1;  // would leave a hole
+
+  vmaunmap(p->pagetable, v, addr, len);
+  if(v->pages)
+    vmpagesdrop(v, addr, len);
+  if(addr == v->va){
+    v->va += len;
+    v->off += len;
+  }
+  v->len -= len;
+  if(v->len == 0)
+    vmafree(v);
+  return 0;
+}
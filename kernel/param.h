@@ -2,12 +2,18 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE      200  // unused i-nodes kept cached
+#define NDCACHE     512  // directory entries in the dentry cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       2000  // size of file system in blocks
+#define NSEG          4  // max demand-paged program segments per process
+#define NVMA         16  // max mmap()ed regions per process
+#define MAXOPBLOCKS  16  // max # of blocks any FS op writes
+#define LOGSIZE      200   // max data blocks in on-disk log
+#define NBUF         (LOGSIZE+MAXSEG+MAXOPBLOCKS)  // minimum size of disk block cache
+#define BCACHEFRAC   8     // disk block cache grows to 1/BCACHEFRAC of free memory
+#define FSSIZE       10000  // size of file system in blocks
+#define MAXREADAHEAD 32    // max blocks read ahead of a sequential reader
+#define MAXSEG       32    // max blocks in one disk request
 #define MAXPATH      128   // maximum file path name
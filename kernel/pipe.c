@@ -7,18 +7,63 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
+#include "poll.h"
 
-#define PIPESIZE 512
+// A pipe's buffer is a ring of whole pages from kalloc(),
+// PIPESIZE bytes to start with; fcntl(F_SETPIPE_SZ) can make
+// it any power of two pages up to PIPEMAXSIZE. Reads and writes
+// copy as much as they can at a time, in contiguous chunks
+// that stop only at page boundaries, and wake the other end
+// once per call rather than once per byte.
+//
+// splice() fills a pipe straight from the buffer cache with
+// pipewait() and pipeput(), which never sleep while the caller
+// holds the source's inode and buffer locks.
+
+#define PIPESIZE    PGSIZE
+#define PIPEMAXSIZE (16*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEMAXSIZE/PGSIZE];  // the buffer
+  uint size;      // bytes in the buffer, a multiple of PGSIZE
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
 };
 
+static struct slab pipeslab;
+
+void
+pipeinit(void)
+{
+  slabinit(&pipeslab, "pipe", sizeof(struct pipe));
+}
+
+// Free the first npage pages of page[].
+static void
+pagesfree(char **page, int npage)
+{
+  for(int i = 0; i < npage; i++)
+    kfree(page[i]);
+}
+
+// Fill page[] with npage pages; returns -1,
+// having allocated none, if memory runs out.
+static int
+pagesalloc(char **page, int npage)
+{
+  for(int i = 0; i < npage; i++){
+    if((page[i] = kalloc()) == 0){
+      pagesfree(page, i);
+      return -1;
+    }
+  }
+  return 0;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -28,8 +73,13 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = slaballoc(&pipeslab)) == 0)
+    goto bad;
+  if(pagesalloc(pi->page, PIPESIZE/PGSIZE) < 0){
+    slabfree(&pipeslab, pi);
     goto bad;
+  }
+  pi->size = PIPESIZE;
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
@@ -38,16 +88,16 @@ pipealloc(struct file **f0, struct file **f1)
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
+  (*f0)->nonblock = 0;
   (*f0)->pipe = pi;
   (*f1)->type = FD_PIPE;
   (*f1)->readable = 0;
   (*f1)->writable = 1;
+  (*f1)->nonblock = 0;
   (*f1)->pipe = pi;
   return 0;
 
  bad:
-  if(pi)
-    kfree((char*)pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -68,15 +118,36 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pagesfree(pi->page, pi->size/PGSIZE);
+    slabfree(&pipeslab, pi);
   } else
     release(&pi->lock);
 }
 
+// The address and length of the longest run of the ring
+// that starts at byte count pos and holds at most n bytes
+// without crossing a page boundary.
+static char*
+pipechunk(struct pipe *pi, uint pos, uint *n)
+{
+  uint off = pos % pi->size;
+
+  if(*n > PGSIZE - off % PGSIZE)
+    *n = PGSIZE - off % PGSIZE;
+  return pi->page[off / PGSIZE] + off % PGSIZE;
+}
+
+// Write n bytes from addr to pi, waiting for room as needed.
+// If user_src==1, addr is a user virtual address;
+// otherwise, it is a kernel address.
+// If nonblock, write only what fits now, and return -1
+// if that's nothing.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, int user_src, uint64 addr, int n, int nonblock)
 {
   int i = 0;
+  uint m;
+  char *buf;
   struct proc *pr = myproc();
 
   acquire(&pi->lock);
@@ -85,15 +156,23 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+    if(pi->nwrite == pi->nread + pi->size){ //DOC: pipewrite-full
+      if(nonblock){
+        if(i == 0)
+          i = -1;
+        break;
+      }
       wakeup(&pi->nread);
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = pi->nread + pi->size - pi->nwrite;  // free space
+      if(m > n - i)
+        m = n - i;
+      buf = pipechunk(pi, pi->nwrite, &m);
+      if(either_copyin(buf, user_src, addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
   wakeup(&pi->nread);
@@ -102,29 +181,170 @@ pipewrite(struct pipe *pi, uint64 addr, int n)
   return i;
 }
 
+// Read up to n bytes from pi to addr, waiting until there
+// is at least one. user_dst is as for pipewrite().
+// If nonblock, return -1 rather than wait.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, int user_dst, uint64 addr, int n, int nonblock)
 {
-  int i;
+  int i = 0;
+  uint m;
+  char *buf;
   struct proc *pr = myproc();
-  char ch;
 
   acquire(&pi->lock);
   while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(killed(pr)){
+    if(nonblock || killed(pr)){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(pi->nread == pi->nwrite)
-      break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+  while(i < n && pi->nread != pi->nwrite){  //DOC: piperead-copy
+    m = pi->nwrite - pi->nread;  // buffered bytes
+    if(m > n - i)
+      m = n - i;
+    buf = pipechunk(pi, pi->nread, &m);
+    if(either_copyout(user_dst, addr + i, buf, m) == -1)
       break;
+    pi->nread += m;
+    i += m;
   }
   wakeup(&pi->nwrite);  //DOC: piperead-wakeup
   release(&pi->lock);
   return i;
 }
+
+// Wait until pi has room for at least one byte.
+// Returns the room, or -1 if the read end is closed
+// or the caller has been killed.
+int
+pipewait(struct pipe *pi)
+{
+  int room;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  for(;;){
+    if(pi->readopen == 0 || killed(pr)){
+      release(&pi->lock);
+      return -1;
+    }
+    if(pi->nwrite != pi->nread + pi->size)
+      break;
+    wakeup(&pi->nread);
+    sleep(&pi->nwrite, &pi->lock);
+  }
+  room = pi->nread + pi->size - pi->nwrite;
+  release(&pi->lock);
+  return room;
+}
+
+// Copy as many of the n bytes at kernel address src into pi
+// as fit without waiting. Returns the number copied, which
+// may be 0, or -1 if the read end is closed.
+int
+pipeput(struct pipe *pi, char *src, int n)
+{
+  int i = 0;
+  uint m;
+  char *buf;
+
+  acquire(&pi->lock);
+  if(pi->readopen == 0){
+    release(&pi->lock);
+    return -1;
+  }
+  while(i < n && pi->nwrite != pi->nread + pi->size){
+    m = pi->nread + pi->size - pi->nwrite;
+    if(m > n - i)
+      m = n - i;
+    buf = pipechunk(pi, pi->nwrite, &m);
+    memmove(buf, src + i, m);
+    pi->nwrite += m;
+    i += m;
+  }
+  if(i > 0)
+    wakeup(&pi->nread);
+  release(&pi->lock);
+  return i;
+}
+
+// For poll(): which of POLLIN, POLLOUT and POLLHUP hold for
+// the read end of pi, or the write end if writable.
+// pe is as for pollwait().
+int
+pipepoll(struct pipe *pi, int writable, struct pollent *pe)
+{
+  int r = 0;
+
+  // the channels that piperead() and pipewrite() sleep on.
+  pollwait(pe, writable ? (void*)&pi->nwrite : (void*)&pi->nread);
+  acquire(&pi->lock);
+  if(writable){
+    if(pi->readopen == 0)
+      r |= POLLHUP;
+    else if(pi->nwrite != pi->nread + pi->size)
+      r |= POLLOUT;
+  } else {
+    if(pi->nread != pi->nwrite)
+      r |= POLLIN;
+    if(pi->writeopen == 0)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// The size of pi's buffer, in bytes.
+int
+pipesize(struct pipe *pi)
+{
+  return pi->size;
+}
+
+// Change the size of pi's buffer to n bytes, rounded up to a
+// power of two pages (so that the byte counts can wrap around).
+// Returns the new size, or -1 if n is too big or too small for
+// the bytes already in the pipe.
+int
+pipesetsize(struct pipe *pi, int n)
+{
+  char *page[PIPEMAXSIZE/PGSIZE], *old[PIPEMAXSIZE/PGSIZE], *src;
+  uint size, nold, len, off, m;
+
+  if(n <= 0 || n > PIPEMAXSIZE)
+    return -1;
+  for(size = PGSIZE; size < n; size *= 2)
+    ;
+  if(pagesalloc(page, size/PGSIZE) < 0)
+    return -1;
+
+  acquire(&pi->lock);
+  len = pi->nwrite - pi->nread;
+  if(len > size){
+    release(&pi->lock);
+    pagesfree(page, size/PGSIZE);
+    return -1;
+  }
+  // move the buffered bytes to the start of the new ring,
+  // a piece at a time, stopping at both rings' page ends.
+  for(off = 0; off < len; off += m){
+    m = len - off;
+    if(m > PGSIZE - off % PGSIZE)
+      m = PGSIZE - off % PGSIZE;
+    src = pipechunk(pi, pi->nread + off, &m);
+    memmove(page[off / PGSIZE] + off % PGSIZE, src, m);
+  }
+  nold = pi->size/PGSIZE;
+  memmove(old, pi->page, sizeof(old));
+  memmove(pi->page, page, sizeof(page));
+  pi->size = size;
+  pi->nread = 0;
+  pi->nwrite = len;
+  wakeup(&pi->nwrite);  // there may be more room
+  release(&pi->lock);
+
+  pagesfree(old, nold);
+  return size;
+}
@@ -0,0 +1,11 @@
+// poll() waits until one of several file descriptors is ready.
+struct pollfd {
+  int fd;
+  short events;   // what to wait for
+  short revents;  // set by poll(): what is ready
+};
+
+#define POLLIN   0x001  // read won't wait
+#define POLLOUT  0x004  // write won't wait
+#define POLLHUP  0x010  // the other end of the pipe is closed
+#define POLLNVAL 0x020  // fd isn't open
@@ -5,6 +5,7 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "kstat.h"
 
 struct cpu cpus[NCPU];
 
@@ -16,7 +17,9 @@ int nextpid = 1;
 struct spinlock pid_lock;
 
 extern void forkret(void);
+static void kthreadret(void);
 static void freeproc(struct proc *p);
+static void runqput(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +29,50 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// Per-CPU run queues. Every RUNNABLE process is on exactly
+// one queue, normally that of the CPU it last ran on, and
+// each CPU's scheduler takes processes from its own queue,
+// stealing from the other CPUs' queues only when its own
+// is empty. A queue's lock is acquired after p->lock,
+// never before, so the scheduler drops the queue lock
+// before it locks the process it took.
+struct runq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+  int len;          // processes on the queue
+
+  // written only by the owning CPU's scheduler.
+  uint64 nrun;      // processes switched to
+  uint64 nsteal;    // of those, taken from another CPU's queue
+  uint64 idle;      // time spent idle, in r_time() units
+};
+
+struct runq runq[NCPU];
+
+// Sleeping processes, hashed by wait channel, so that
+// wakeup() only looks at processes that might be
+// sleeping on its channel. A SLEEPING process is on the
+// list of its channel's bucket. A bucket's lock is
+// acquired before any p->lock.
+//
+// A process in poll() is instead on the poll lists of the
+// buckets of all the channels it waits on, and sleeps on
+// pollchan, which is on no list and never woken directly:
+// wakeup() of any of its channels makes it RUNNABLE.
+#define NWAITQ 61
+#define WQHASH(chan) (((uint64)(chan) / 8) % NWAITQ)
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;
+  struct pollent *poll;
+};
+
+struct waitq waitq[NWAITQ];
+
+static char pollchan;
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -51,6 +98,10 @@ procinit(void)
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(int i = 0; i < NWAITQ; i++)
+    initlock(&waitq[i].lock, "waitq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
       p->state = UNUSED;
@@ -161,13 +212,16 @@ freeproc(struct proc *p)
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
+  p->ring = 0;
   p->sz = 0;
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
+  p->kfn = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->nseg = 0;
   p->state = UNUSED;
 }
 
@@ -212,6 +266,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, URING, 1, 1);  // if mapped
   uvmfree(pagetable, sz);
 }
 
@@ -248,13 +303,16 @@ userinit(void)
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
+  safestrcpy(p->cwdpath, "/", sizeof(p->cwdpath));
 
-  p->state = RUNNABLE;
+  runqput(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
+// Growing only reserves the address space; vmfault()
+// allocates each page when it is first touched.
 // Return 0 on success, -1 on failure.
 int
 growproc(int n)
@@ -264,9 +322,9 @@ growproc(int n)
 
   sz = p->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+    if(sz + n > mmapbase(p))
       return -1;
-    }
+    sz += n;
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
@@ -295,6 +353,11 @@ fork(void)
     return -1;
   }
   np->sz = p->sz;
+  if(mmapfork(p, np) < 0){
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -307,6 +370,11 @@ fork(void)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  safestrcpy(np->cwdpath, p->cwdpath, sizeof(np->cwdpath));
+  if(p->exe)
+    np->exe = iexec(p->exe);
+  memmove(np->seg, p->seg, sizeof(p->seg));
+  np->nseg = p->nseg;
 
   safestrcpy(np->name, p->name, sizeof(p->name));
 
@@ -319,7 +387,8 @@ fork(void)
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  np->cpu = p->cpu;
+  runqput(np);
   release(&np->lock);
 
   return pid;
@@ -351,6 +420,9 @@ exit(int status)
   if(p == initproc)
     panic("init exiting");
 
+  // Write back and unmap mapped files.
+  mmapclear(p, p->pagetable);
+
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd]){
@@ -362,8 +434,11 @@ exit(int status)
 
   begin_op();
   iput(p->cwd);
+  if(p->exe)
+    iputexec(p->exe);
   end_op();
   p->cwd = 0;
+  p->exe = 0;
 
   acquire(&wait_lock);
 
@@ -394,6 +469,9 @@ wait(uint64 addr)
   int havekids, pid;
   struct proc *p = myproc();
 
+  if(addr != 0)
+    uvmpagein(addr, sizeof(int));
+
   acquire(&wait_lock);
 
   for(;;){
@@ -434,10 +512,55 @@ wait(uint64 addr)
   }
 }
 
+// Mark p RUNNABLE and append it to the run queue
+// of the CPU it last ran on.
+// Caller must hold p->lock.
+static void
+runqput(struct proc *p)
+{
+  struct runq *rq = &runq[p->cpu];
+
+  if(!holding(&p->lock))
+    panic("runqput");
+
+  p->state = RUNNABLE;
+  p->rqnext = 0;
+  acquire(&rq->lock);
+  if(rq->tail)
+    rq->tail->rqnext = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->len++;
+  release(&rq->lock);
+}
+
+// Remove and return the process at the head of rq, or 0.
+// The process stays RUNNABLE, but is on no queue, so
+// nothing else will pick it up before the caller locks it.
+static struct proc*
+runqget(struct runq *rq)
+{
+  struct proc *p;
+
+  acquire(&rq->lock);
+  p = rq->head;
+  if(p){
+    rq->head = p->rqnext;
+    if(rq->head == 0)
+      rq->tail = 0;
+    rq->len--;
+    p->rqnext = 0;
+  }
+  release(&rq->lock);
+  return p;
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take a process from this CPU's run queue, or
+//    steal one from another CPU's queue.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
@@ -446,35 +569,50 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  struct runq *rq = &runq[cpuid()];
+  struct runq *v;
+  uint64 t0;
   
   c->proc = 0;
   for(;;){
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    int found_runnable = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-        found_runnable = 1;
+    p = runqget(rq);
+    if(p == 0){
+      for(v = runq; v < &runq[NCPU] && p == 0; v++){
+        if(v != rq && v->len > 0)  // racy peek; runqget() rechecks
+          p = runqget(v);
       }
-      release(&p->lock);
+      if(p)
+        rq->nsteal++;
     }
 
-    if (found_runnable == 0) {
+    if(p == 0){
+      t0 = r_time();
       intr_on();
       asm volatile("wfi");
+      rq->idle += r_time() - t0;
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler: not runnable");
+
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->cpu = rq - runq;
+    rq->nrun++;
+    c->proc = p;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->proc = 0;
+    release(&p->lock);
   }
 }
 
@@ -511,11 +649,41 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  runqput(p);
   sched();
   release(&p->lock);
 }
 
+// Start a kernel thread, a process with no user memory
+// that runs fn() in the kernel. fn must never return.
+void
+kthread(void (*fn)(void), char *name)
+{
+  struct proc *p;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->kfn = fn;
+  p->context.ra = (uint64)kthreadret;
+  safestrcpy(p->name, name, sizeof(p->name));
+  runqput(p);
+  release(&p->lock);
+}
+
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadret.
+static void
+kthreadret(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
@@ -537,27 +705,50 @@ forkret(void)
   usertrapret();
 }
 
+// Unlink p from wait queue wq.
+// Caller must hold wq->lock.
+static void
+wqremove(struct waitq *wq, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &wq->head; *pp; pp = &(*pp)->wqnext){
+    if(*pp == p){
+      *pp = p->wqnext;
+      p->wqnext = 0;
+      return;
+    }
+  }
+  panic("wqremove");
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct waitq *wq = &waitq[WQHASH(chan)];
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
-  // Once we hold p->lock, we can be
+  // Once we hold chan's wait queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup locks p->lock),
+  // (wakeup locks the wait queue),
   // so it's okay to release lk.
 
-  acquire(&p->lock);  //DOC: sleeplock1
+  acquire(&wq->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
   release(lk);
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
+  p->wqnext = wq->head;
+  wq->head = p;
+  release(&wq->lock);
 
+  // wakeup() or kill() takes p off the wait queue.
   sched();
 
   // Tidy up.
@@ -573,17 +764,106 @@ sleep(void *chan, struct spinlock *lk)
 void
 wakeup(void *chan)
 {
-  struct proc *p;
+  struct waitq *wq = &waitq[WQHASH(chan)];
+  struct proc *p, **pp;
+  struct pollent *pe;
+
+  acquire(&wq->lock);
+  for(pp = &wq->head; (p = *pp) != 0; ){
+    // p->chan can't change while p is on the queue.
+    if(p->chan != chan){
+      pp = &p->wqnext;
+      continue;
+    }
+    *pp = p->wqnext;
+    p->wqnext = 0;
+    acquire(&p->lock);
+    if(p->state != SLEEPING)
+      panic("wakeup");
+    runqput(p);
+    release(&p->lock);
+  }
+  for(pe = wq->poll; pe; pe = pe->next){
+    if(pe->chan != chan)
+      continue;
+    p = pe->proc;
+    acquire(&p->lock);
+    p->pollwoken = 1;
+    if(p->state == SLEEPING && p->chan == &pollchan)
+      runqput(p);
+    release(&p->lock);
+  }
+  release(&wq->lock);
+}
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    if(p != myproc()){
-      acquire(&p->lock);
-      if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
+// Have the next pollsleep() return at once if chan is
+// woken up from now on, using pe to remember that; the
+// caller then checks whatever chan's sleepers wait for.
+// pe may be 0, to check without waiting.
+void
+pollwait(struct pollent *pe, void *chan)
+{
+  struct waitq *wq = &waitq[WQHASH(chan)];
+
+  if(pe == 0)
+    return;
+  pe->chan = chan;
+  pe->proc = myproc();
+  acquire(&wq->lock);
+  pe->next = wq->poll;
+  wq->poll = pe;
+  release(&wq->lock);
+}
+
+// Take pe, if given to pollwait(), off its channel.
+void
+pollcancel(struct pollent *pe)
+{
+  struct waitq *wq;
+  struct pollent **pp;
+
+  if(pe->chan == 0)
+    return;
+  wq = &waitq[WQHASH(pe->chan)];
+  acquire(&wq->lock);
+  for(pp = &wq->poll; *pp; pp = &(*pp)->next){
+    if(*pp == pe){
+      *pp = pe->next;
+      break;
     }
   }
+  release(&wq->lock);
+  pe->chan = 0;
+}
+
+// Forget wakeups seen by earlier pollwait()s; call before
+// pollwait()ing on the channels to check.
+void
+pollstart(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  p->pollwoken = 0;
+  release(&p->lock);
+}
+
+// Sleep until a channel given to pollwait() since
+// pollstart() is woken up, unless one already has been,
+// or until the process is killed.
+void
+pollsleep(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  if(p->pollwoken == 0 && p->killed == 0){
+    p->chan = &pollchan;
+    p->state = SLEEPING;
+    sched();
+    p->chan = 0;
+  }
+  release(&p->lock);
 }
 
 // Kill the process with the given pid.
@@ -593,16 +873,33 @@ int
 kill(int pid)
 {
   struct proc *p;
+  struct waitq *wq;
+  void *chan;
 
   for(p = proc; p < &proc[NPROC]; p++){
     acquire(&p->lock);
     if(p->pid == pid){
       p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
+      chan = p->state == SLEEPING ? p->chan : 0;
+      if(chan == &pollchan){
+        // on no wait queue; see pollsleep().
+        runqput(p);
+        chan = 0;
       }
       release(&p->lock);
+      if(chan){
+        // Wake process from sleep(). The wait queue's lock
+        // must be acquired first, so check again with both.
+        wq = &waitq[WQHASH(chan)];
+        acquire(&wq->lock);
+        acquire(&p->lock);
+        if(p->pid == pid && p->state == SLEEPING && p->chan == chan){
+          wqremove(wq, p);
+          runqput(p);
+        }
+        release(&p->lock);
+        release(&wq->lock);
+      }
       return 0;
     }
     release(&p->lock);
@@ -688,3 +985,17 @@ procdump(void)
     printf("\n");
   }
 }
+
+// Copy out the per-CPU scheduler counters.
+void
+runqstat(struct schedstat *st)
+{
+  for(int i = 0; i < NCPU; i++){
+    acquire(&runq[i].lock);
+    st->cpu[i].len = runq[i].len;
+    st->cpu[i].nrun = runq[i].nrun;
+    st->cpu[i].nsteal = runq[i].nsteal;
+    st->cpu[i].idle = runq[i].idle;
+    release(&runq[i].lock);
+  }
+}
@@ -81,6 +81,37 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A program segment that exec() did not read into memory.
+// vmfault() reads each page from the executable the first
+// time the process touches it.
+struct seg {
+  uint64 va;      // start virtual address, page-aligned
+  uint64 memsz;   // size in memory
+  uint off;       // file offset of va
+  uint filesz;    // bytes from the file; the rest is zero
+  int perm;       // PTE_X and/or PTE_W
+};
+
+// A file mapped by mmap(). vmfault() reads each page from
+// the file the first time the process touches it.
+struct vma {
+  uint64 va;       // start, page-aligned; 0 if the slot is free
+  uint64 len;      // a multiple of PGSIZE
+  uint off;        // file offset of va
+  int prot;        // PROT_READ and/or PROT_WRITE
+  int flags;       // MAP_SHARED or MAP_PRIVATE
+  struct file *f;
+  struct vmpages *pages; // MAP_SHARED: shared with forked relatives
+};
+
+// poll() waits on several channels at once with one
+// of these on each channel's wait queue bucket.
+struct pollent {
+  void *chan;
+  struct proc *proc;
+  struct pollent *next;  // on the bucket's list (waitq lock)
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -91,6 +122,10 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  int cpu;                     // CPU whose run queue p goes on
+  struct proc *rqnext;         // Next on run queue (runq lock)
+  struct proc *wqnext;         // Next on wait queue (waitq lock)
+  int pollwoken;               // A channel poll() waits on was woken
 
   // wait_lock must be held when using this:
   struct proc *parent;         // Parent process
@@ -100,8 +135,15 @@ struct proc {
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct uring *ring;          // page mapped at URING, or 0
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  char cwdpath[MAXPATH];       // Absolute path of cwd, or "" if too long
+  struct inode *exe;           // Executable, for demand paging
+  struct seg seg[NSEG];        // Segments paged in from exe
+  int nseg;
+  struct vma vma[NVMA];        // mmap()ed files, below URING
+  void (*kfn)(void);           // Kernel thread's function, or 0
   char name[16];               // Process name (debugging)
 };
@@ -0,0 +1,129 @@
+// Allocator for small kernel objects.
+//
+// Each struct slab hands out objects of one size. Objects
+// live in whole pages from kalloc(); a page starts with a
+// struct slabpage header, followed by as many objects as
+// fit. Pages with free objects are kept on the slab's
+// partial list, and a page is given back to kalloc() as
+// soon as all of its objects are free.
+//
+// kalloc() may call into the buffer cache to reclaim memory,
+// which frees objects, so slaballoc() never holds the slab's
+// lock while it calls kalloc().
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "riscv.h"
+#include "defs.h"
+
+struct object {
+  struct object *next;
+};
+
+struct slabpage {
+  struct slabpage *next;    // partial list
+  struct slabpage *prev;
+  struct object *free;      // free objects in this page
+  uint nfree;
+};
+
+// objects start after the header, 8-byte aligned.
+#define HDRSIZE ((sizeof(struct slabpage) + 7) & ~7)
+
+void
+slabinit(struct slab *s, char *name, uint size)
+{
+  initlock(&s->lock, name);
+  s->name = name;
+  s->size = (size + 7) & ~7;
+  s->perpage = (PGSIZE - HDRSIZE) / s->size;
+  if(s->perpage == 0)
+    panic("slabinit: object too big");
+  s->partial = 0;
+  s->nalloc = 0;
+}
+
+static void
+partialinsert(struct slab *s, struct slabpage *pg)
+{
+  pg->prev = 0;
+  pg->next = s->partial;
+  if(s->partial)
+    s->partial->prev = pg;
+  s->partial = pg;
+}
+
+static void
+partialremove(struct slab *s, struct slabpage *pg)
+{
+  if(pg->prev)
+    pg->prev->next = pg->next;
+  else
+    s->partial = pg->next;
+  if(pg->next)
+    pg->next->prev = pg->prev;
+}
+
+// Allocate a zeroed object from s.
+// Returns 0 if there is no memory for it.
+void*
+slaballoc(struct slab *s)
+{
+  struct slabpage *pg;
+  struct object *o;
+  char *p;
+
+  acquire(&s->lock);
+  while(s->partial == 0){
+    release(&s->lock);
+    if((pg = kalloc()) == 0)
+      return 0;
+    pg->free = 0;
+    pg->nfree = 0;
+    for(p = (char*)pg + HDRSIZE; p + s->size <= (char*)pg + PGSIZE; p += s->size){
+      o = (struct object*)p;
+      o->next = pg->free;
+      pg->free = o;
+      pg->nfree++;
+    }
+    acquire(&s->lock);
+    partialinsert(s, pg);
+  }
+
+  pg = s->partial;
+  o = pg->free;
+  pg->free = o->next;
+  if(--pg->nfree == 0)
+    partialremove(s, pg);
+  s->nalloc++;
+  release(&s->lock);
+
+  memset(o, 0, s->size);
+  return o;
+}
+
+// Free an object that slaballoc(s) returned.
+void
+slabfree(struct slab *s, void *v)
+{
+  struct slabpage *pg = (struct slabpage*)PGROUNDDOWN((uint64)v);
+  struct object *o = v;
+
+  acquire(&s->lock);
+  o->next = pg->free;
+  pg->free = o;
+  if(pg->nfree++ == 0)
+    partialinsert(s, pg);
+  s->nalloc--;
+  if(pg->nfree == s->perpage){
+    partialremove(s, pg);
+  } else {
+    pg = 0;
+  }
+  release(&s->lock);
+
+  if(pg)
+    kfree(pg);
+}
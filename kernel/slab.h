@@ -0,0 +1,10 @@
+// A cache of equal-sized kernel objects, carved out of
+// pages from kalloc().
+struct slab {
+  struct spinlock lock;
+  char *name;               // Name of the cache, for debugging
+  uint size;                // Object size in bytes
+  uint perpage;             // Objects that fit in one page
+  struct slabpage *partial; // Pages with at least one free object
+  uint64 nalloc;            // Objects currently allocated
+};
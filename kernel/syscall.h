@@ -22,3 +22,12 @@
 #define SYS_close  21
 #define SYS_getcwd 22
 #define SYS_gettime 23
+#define SYS_kstat  24
+#define SYS_fsync  25
+#define SYS_fcntl  26
+#define SYS_splice 27
+#define SYS_poll   28
+#define SYS_uring_setup 29
+#define SYS_uring_enter 30
+#define SYS_mmap   31
+#define SYS_munmap 32
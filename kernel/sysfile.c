@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -119,6 +120,140 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Wait until the file system changes made so far, including
+// those to the file open as fd, are safely on disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  log_sync();
+  return 0;
+}
+
+// Get or change a property of the file open as fd;
+// see fcntl.h for the commands.
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  argint(1, &cmd);
+  argint(2, &arg);
+
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesize(f->pipe);
+  case F_SETPIPE_SZ:
+    if(f->type != FD_PIPE)
+      return -1;
+    return pipesetsize(f->pipe, arg);
+  case F_GETFL:
+    return (f->writable ? (f->readable ? O_RDWR : O_WRONLY) : O_RDONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+// Wait until one of the nfds file descriptors in the
+// struct pollfd array at addr is ready for the events
+// asked for, or for timeout clock ticks if timeout >= 0.
+// Negative fds are skipped.
+// Sets each revents and returns the number of fds with
+// any set, 0 if the time ran out.
+//
+// Each round puts a struct pollent on the wait channel of
+// every fd and of the clock, then checks the fds and
+// sleeps until one of those channels is woken.
+uint64
+sys_poll(void)
+{
+  struct pollfd fds[NOFILE];
+  struct pollent pe[NOFILE], tpe;
+  struct proc *p = myproc();
+  struct file *f;
+  uint64 addr;
+  int nfds, timeout, i, n;
+  uint ticks0;
+
+  argaddr(0, &addr);
+  argint(1, &nfds);
+  argint(2, &timeout);
+  if(nfds < 0 || nfds > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, nfds * sizeof(fds[0])) < 0)
+    return -1;
+
+  acquire(&tickslock);
+  ticks0 = ticks;
+  release(&tickslock);
+  tpe.chan = 0;
+  for(;;){
+    pollstart();
+    if(timeout > 0)
+      pollwait(&tpe, &ticks);
+    n = 0;
+    for(i = 0; i < nfds; i++){
+      pe[i].chan = 0;
+      fds[i].revents = 0;
+      if(fds[i].fd < 0)
+        continue;  // ignored
+      if(fds[i].fd >= NOFILE || (f = p->ofile[fds[i].fd]) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(f, timeout ? &pe[i] : 0) &
+                         (fds[i].events | POLLHUP);
+      if(fds[i].revents)
+        n++;
+    }
+    if(n == 0 && timeout != 0 && !killed(p)){
+      acquire(&tickslock);
+      if(timeout > 0 && ticks - ticks0 >= timeout)
+        timeout = 0;
+      release(&tickslock);
+      if(timeout != 0)
+        pollsleep();
+    }
+    for(i = 0; i < nfds; i++)
+      pollcancel(&pe[i]);
+    pollcancel(&tpe);
+    if(n > 0 || timeout == 0)
+      break;
+    if(killed(p))
+      return -1;
+  }
+
+  if(copyout(p->pagetable, addr, (char*)fds, nfds * sizeof(fds[0])) < 0)
+    return -1;
+  return n;
+}
+
+// Move up to n bytes from fdin to fdout inside the kernel,
+// for copying a file to a pipe, a file or the console
+// without a trip through a user buffer. Returns the number
+// of bytes moved, 0 at the end of fdin.
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0)
+    return -1;
+  argint(2, &n);
+  return filesplice(in, out, n);
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -222,6 +357,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcacheenter(dp, name, 0, 0);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -301,18 +437,14 @@ create(char *path, short type, short major, short minor)
   return 0;
 }
 
-uint64
-sys_open(void)
+// Open path with mode omode, for open() and the ring's
+// URING_OPEN. Returns the new file descriptor, or -1.
+int
+fileopen(char *path, int omode)
 {
-  char path[MAXPATH];
-  int fd, omode;
+  int fd;
   struct file *f;
   struct inode *ip;
-  int n;
-
-  argint(1, &omode);
-  if((n = argstr(0, path, MAXPATH)) < 0)
-    return -1;
 
   begin_op();
 
@@ -333,6 +465,12 @@ sys_open(void)
       end_op();
       return -1;
     }
+    // a running program's file can't be written.
+    if(ip->nexec > 0 && (omode & (O_WRONLY|O_RDWR|O_TRUNC))){
+      iunlockput(ip);
+      end_op();
+      return -1;
+    }
   }
 
   if(ip->type == T_DEVICE && (ip->major < 0 || ip->major >= NDEV)){
@@ -355,10 +493,14 @@ sys_open(void)
   } else {
     f->type = FD_INODE;
     f->off = (omode & O_APPEND) ? ip->size: 0; // Offset by the size of the file
+    f->raoff = f->off;
+    f->rawin = 0;
+    f->ranext = 0;
   }
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -370,6 +512,18 @@ sys_open(void)
   return fd;
 }
 
+uint64
+sys_open(void)
+{
+  char path[MAXPATH];
+  int omode;
+
+  argint(1, &omode);
+  if(argstr(0, path, MAXPATH) < 0)
+    return -1;
+  return fileopen(path, omode);
+}
+
 uint64
 sys_mkdir(void)
 {
@@ -406,38 +560,101 @@ sys_mknod(void)
   return 0;
 }
 
+// copy the absolute path of the current directory to the
+// user buffer: the one chdir() keeps up to date, or, if
+// that got too long to keep, one found by walking "..".
 uint64
 sys_getcwd(void)
 {
   uint64 ubuf;
-  int sz;
+  int sz, n, r;
+  char *buf;
+  struct proc *p = myproc();
 
-  begin_op();
   argaddr(0, &ubuf);
   argint(1, &sz);
 
-  if (sz > PGSIZE) {
-    end_op();
-    return -1;
+  if(p->cwdpath[0]){
+    n = strlen(p->cwdpath) + 1;
+    if(sz < n)
+      return -1;
+    if(copyout(p->pagetable, ubuf, p->cwdpath, n) < 0)
+      return -1;
+    return 0;
   }
 
-  char *buf = kalloc();
-  getcwd(buf, sz);
+  if(sz <= 0)
+    return -1;
+  if(sz > PGSIZE)
+    sz = PGSIZE;
+  if((buf = kalloc()) == 0)
+    return -1;
+  begin_op();
+  r = dirpath(p->cwd, buf, sz);
+  end_op();
+  if(r == 0 && copyout(p->pagetable, ubuf, buf, strlen(buf) + 1) < 0)
+    r = -1;
+  kfree(buf);
+  return r;
+}
 
-  if (copyout(myproc()->pagetable, ubuf, buf, sz) < 0) {
-    end_op();
+// Store in dst the absolute path of path, relative to the
+// absolute path cwd, with "." and ".." resolved and names
+// cut to DIRSIZ as namei() would. (There are no symbolic
+// links, so "a/.." is always where we started.)
+// Returns -1 if cwd is unknown ("") or the result is too long.
+static int
+cwdjoin(char *dst, char *cwd, char *path)
+{
+  char *s;
+  int n = 0, len;
+
+  if(*path != '/' && *cwd == 0)
     return -1;
+  // dst[0..n) is an absolute path with no trailing
+  // slash, so "" stands for the root.
+  if(*path != '/'){
+    n = strlen(cwd);
+    memmove(dst, cwd, n);
+    if(n == 1)
+      n = 0;
   }
-
-  kfree(buf);
-  end_op();
+  for(;;){
+    while(*path == '/')
+      path++;
+    if(*path == 0)
+      break;
+    s = path;
+    while(*path != '/' && *path != 0)
+      path++;
+    len = path - s;
+    if(len == 1 && s[0] == '.')
+      continue;
+    if(len == 2 && s[0] == '.' && s[1] == '.'){
+      while(n > 0 && dst[n-1] != '/')
+        n--;
+      if(n > 0)
+        n--;
+      continue;
+    }
+    if(len > DIRSIZ)
+      len = DIRSIZ;
+    if(n + 1 + len >= MAXPATH)
+      return -1;
+    dst[n++] = '/';
+    memmove(dst + n, s, len);
+    n += len;
+  }
+  if(n == 0)
+    dst[n++] = '/';
+  dst[n] = '\0';
   return 0;
 }
 
 uint64
 sys_chdir(void)
 {
-  char path[MAXPATH];
+  char path[MAXPATH], cwdpath[MAXPATH];
   struct inode *ip;
   struct proc *p = myproc();
   
@@ -456,6 +673,10 @@ sys_chdir(void)
   iput(p->cwd);
   end_op();
   p->cwd = ip;
+  // a path too long to keep is left for getcwd() to find.
+  if(cwdjoin(cwdpath, p->cwdpath, path) < 0)
+    cwdpath[0] = '\0';
+  safestrcpy(p->cwdpath, cwdpath, sizeof(p->cwdpath));
   return 0;
 }
 
@@ -5,6 +5,7 @@
 #include "memlayout.h"
 #include "spinlock.h"
 #include "proc.h"
+#include "kstat.h"
 
 uint64
 sys_exit(void)
@@ -99,3 +100,55 @@ sys_gettime(void)
   // Deference to get Time
   return *rtc_dev;
 }
+
+// copy a kernel statistics structure, selected by
+// kind (see kstat.h), out to the user buffer addr.
+uint64
+sys_kstat(void)
+{
+  int kind, n;
+  uint64 addr;
+  union {
+    struct kmemstat kmem;
+    struct schedstat sched;
+    struct bcachestat bcache;
+    struct diskstat disk;
+    struct dcachestat dcache;
+  } st;
+  int size;
+
+  argint(0, &kind);
+  argaddr(1, &addr);
+  argint(2, &n);
+
+  switch(kind){
+  case KSTAT_KMEM:
+    kallocstat(&st.kmem);
+    size = sizeof(st.kmem);
+    break;
+  case KSTAT_SCHED:
+    runqstat(&st.sched);
+    size = sizeof(st.sched);
+    break;
+  case KSTAT_BCACHE:
+    bcachestat(&st.bcache);
+    size = sizeof(st.bcache);
+    break;
+  case KSTAT_DISK:
+    iostat(&st.disk);
+    size = sizeof(st.disk);
+    break;
+  case KSTAT_DCACHE:
+    dcachestat(&st.dcache);
+    size = sizeof(st.dcache);
+    break;
+  default:
+    return -1;
+  }
+
+  if(n < size)
+    return -1;
+  if(copyout(myproc()->pagetable, addr, (char *)&st, size) < 0)
+    return -1;
+  return size;
+}
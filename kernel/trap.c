@@ -67,6 +67,10 @@ usertrap(void)
     syscall();
   } else if((which_dev = devintr()) != 0){
     // ok
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            vmfault(p->pagetable, r_stval(), r_scause() == 15) == 0){
+    // instruction, load or store page fault on a demand-paged,
+    // lazily allocated or copy-on-write page, which is now mapped.
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
@@ -167,6 +171,7 @@ clockintr()
   ticks++;
   wakeup(&ticks);
   release(&tickslock);
+  log_tick();
 }
 
 // check if it's an external interrupt or software interrupt,
@@ -0,0 +1,129 @@
+// Submission and completion rings.
+//
+// uring_setup() maps a page holding a struct uring (see
+// uring.h) at URING, shared by the process and the kernel.
+// The process fills in submission queue entries and advances
+// sqtail; uring_enter() then runs the queued operations in
+// order and posts a completion for each, so that a batch of
+// reads, writes, opens and closes costs one trap rather than
+// one each.
+//
+// The operations run one after another in the calling
+// process, just as the system calls would: a read of an
+// empty pipe waits, and holds up the rest of the batch.
+// There is no kernel thread polling the ring, so a process
+// always has to call uring_enter().
+//
+// The kernel uses the page through its direct mapping. The
+// process can scribble on all of it, so each entry is copied
+// before it is used and slots are always taken modulo the
+// ring sizes; a bad head or tail only hurts the process.
+//
+// The ring goes away at exec() and exit(), and isn't
+// inherited by fork().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "fs.h"
+#include "sleeplock.h"
+#include "file.h"
+#include "uring.h"
+
+// Map the calling process's ring, if it hasn't one yet.
+// Returns its address, URING, or -1.
+uint64
+sys_uring_setup(void)
+{
+  struct proc *p = myproc();
+  struct uring *r;
+
+  if(p->ring)
+    return URING;
+  if((r = kalloc()) == 0)
+    return -1;
+  memset(r, 0, PGSIZE);
+  if(mappages(p->pagetable, URING, PGSIZE, (uint64)r, PTE_R | PTE_W | PTE_U) < 0){
+    kfree(r);
+    return -1;
+  }
+  p->ring = r;
+  return URING;
+}
+
+// Run one submission; returns the result for its completion.
+static int
+ringop(struct sqe *e)
+{
+  struct proc *p = myproc();
+  struct file *f;
+  char path[MAXPATH];
+
+  if(e->op == URING_NOP)
+    return 0;
+  if(e->op == URING_OPEN){
+    if(fetchstr(e->addr, path, MAXPATH) < 0)
+      return -1;
+    return fileopen(path, e->n);
+  }
+
+  if(e->fd < 0 || e->fd >= NOFILE || (f = p->ofile[e->fd]) == 0)
+    return -1;
+  switch(e->op){
+  case URING_READ:
+    return fileread(f, e->addr, e->n);
+  case URING_WRITE:
+    return filewrite(f, e->addr, e->n);
+  case URING_CLOSE:
+    p->ofile[e->fd] = 0;
+    fileclose(f);
+    return 0;
+  case URING_FSYNC:
+    log_sync();
+    return 0;
+  }
+  return -1;
+}
+
+// Run up to n queued submissions, stopping early if the
+// submission queue runs dry, the completion queue fills up,
+// or the process is killed. Returns the number run.
+uint64
+sys_uring_enter(void)
+{
+  struct proc *p = myproc();
+  struct uring *r = p->ring;
+  struct sqe e;
+  struct cqe *c;
+  int n, done, res;
+
+  argint(0, &n);
+  if(r == 0)
+    return -1;
+
+  for(done = 0; done < n; done++){
+    if(r->sqhead == r->sqtail || r->cqtail - r->cqhead >= URING_NCQ)
+      break;
+    __sync_synchronize();  // read the entry only after sqtail
+    e = r->sq[r->sqhead % URING_NSQ];
+    r->sqhead++;
+
+    res = ringop(&e);
+
+    c = &r->cq[r->cqtail % URING_NCQ];
+    c->data = e.data;
+    c->res = res;
+    __sync_synchronize();  // fill in the completion before cqtail
+    r->cqtail++;
+
+    if(killed(p)){
+      done++;
+      break;
+    }
+  }
+  return done;
+}
@@ -0,0 +1,39 @@
+// Submission and completion rings, shared by a process and
+// the kernel in the page at URING; see uring.c.
+
+#define URING_NSQ 64  // submission queue entries
+#define URING_NCQ 64  // completion queue entries
+
+// operations
+#define URING_NOP   0
+#define URING_READ  1  // read(fd, addr, n)
+#define URING_WRITE 2  // write(fd, addr, n)
+#define URING_OPEN  3  // open(addr, n): the path is at addr, n is the mode
+#define URING_CLOSE 4  // close(fd)
+#define URING_FSYNC 5  // fsync(fd)
+
+struct sqe {
+  int op;
+  int fd;
+  uint64 addr;
+  int n;
+  int pad;
+  uint64 data;  // copied to the completion, to tell them apart
+};
+
+struct cqe {
+  uint64 data;
+  int res;      // what the system call would have returned
+  int pad;
+};
+
+// head and tail count entries since uring_setup();
+// entry i is in slot i % URING_NSQ (or URING_NCQ).
+struct uring {
+  uint sqhead;  // next submission the kernel takes
+  uint sqtail;  // next submission the process fills in
+  uint cqhead;  // next completion the process takes
+  uint cqtail;  // next completion the kernel posts
+  struct sqe sq[URING_NSQ];
+  struct cqe cq[URING_NCQ];
+};
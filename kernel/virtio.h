@@ -45,9 +45,11 @@
 #define VIRTIO_RING_F_INDIRECT_DESC 28
 #define VIRTIO_RING_F_EVENT_IDX     29
 
-// this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// at most this many virtio descriptors; virtio_disk_init()
+// asks for fewer if the device's queue is smaller.
+// must be a power of two, small enough that each of
+// the three rings below fits in a page.
+#define NUM 256
 
 // a single descriptor, from the spec.
 struct virtq_desc {
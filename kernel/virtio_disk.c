@@ -22,7 +22,7 @@
 static struct disk {
   // a set (not a ring) of DMA descriptors, with which the
   // driver tells the device where to read and write individual
-  // disk operations. there are NUM descriptors.
+  // disk operations. there are num descriptors.
   // most commands consist of a "chain" (a linked list) of a couple of
   // these descriptors.
   struct virtq_desc *desc;
@@ -30,23 +30,27 @@ static struct disk {
   // a ring in which the driver writes descriptor numbers
   // that the driver would like the device to process.  it only
   // includes the head descriptor of each chain. the ring has
-  // NUM elements.
+  // num elements.
   struct virtq_avail *avail;
 
   // a ring in which the device writes descriptor numbers that
   // the device has finished processing (just the head of each chain).
-  // there are NUM used ring entries.
+  // there are num used ring entries.
   struct virtq_used *used;
 
   // our own book-keeping.
+  int num;         // descriptors in the queue, at most NUM.
   char free[NUM];  // is a descriptor free?
-  uint16 used_idx; // we've looked this far in used[2..NUM].
+  uint16 freelist[NUM]; // stack of free descriptors.
+  int nfree;
+  uint16 used_idx; // we've looked this far in used[2..num].
+  int unkicked;    // requests published since the last notify.
 
   // track info about in-flight operations,
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b; // first of the request's buffers
     char status;
   } info[NUM];
 
@@ -110,11 +114,14 @@ virtio_disk_init(void)
   if(*R(VIRTIO_MMIO_QUEUE_READY))
     panic("virtio disk should not be ready");
 
-  // check maximum queue size.
+  // check maximum queue size, and use the largest
+  // power of two that both we and the device allow.
   uint32 max = *R(VIRTIO_MMIO_QUEUE_NUM_MAX);
   if(max == 0)
     panic("virtio disk has no queue 0");
-  if(max < NUM)
+  for(disk.num = NUM; disk.num > max; disk.num /= 2)
+    ;
+  if(disk.num < MAXSEG+2)
     panic("virtio disk max queue too short");
 
   // allocate and zero queue memory.
@@ -128,7 +135,7 @@ virtio_disk_init(void)
   memset(disk.used, 0, PGSIZE);
 
   // set queue size.
-  *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
+  *R(VIRTIO_MMIO_QUEUE_NUM) = disk.num;
 
   // write physical addresses.
   *R(VIRTIO_MMIO_QUEUE_DESC_LOW) = (uint64)disk.desc;
@@ -141,9 +148,11 @@ virtio_disk_init(void)
   // queue is ready.
   *R(VIRTIO_MMIO_QUEUE_READY) = 0x1;
 
-  // all NUM descriptors start out unused.
-  for(int i = 0; i < NUM; i++)
+  // all the descriptors start out unused.
+  for(int i = disk.num - 1; i >= 0; i--){
     disk.free[i] = 1;
+    disk.freelist[disk.nfree++] = i;
+  }
 
   // tell device we're completely ready.
   status |= VIRTIO_CONFIG_S_DRIVER_OK;
@@ -156,20 +165,20 @@ virtio_disk_init(void)
 static int
 alloc_desc()
 {
-  for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
-      return i;
-    }
-  }
-  return -1;
+  int i;
+
+  if(disk.nfree == 0)
+    return -1;
+  i = disk.freelist[--disk.nfree];
+  disk.free[i] = 0;
+  return i;
 }
 
 // mark a descriptor as free.
 static void
 free_desc(int i)
 {
-  if(i >= NUM)
+  if(i >= disk.num)
     panic("free_desc 1");
   if(disk.free[i])
     panic("free_desc 2");
@@ -178,7 +187,7 @@ free_desc(int i)
   disk.desc[i].flags = 0;
   disk.desc[i].next = 0;
   disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  disk.freelist[disk.nfree++] = i;
 }
 
 // free a chain of descriptors.
@@ -196,43 +205,50 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  if(disk.nfree < n)
+    return -1;
+  for(int i = 0; i < n; i++)
     idx[i] = alloc_desc();
-    if(idx[i] < 0){
-      for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
-      return -1;
-    }
-  }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// Queue a transfer of the locked buffers b, b->qnext, ...,
+// which go to or from consecutive blocks starting at
+// b->ioblock, as a single request, and publish it in the
+// avail ring without notifying the device;
+// see virtio_disk_kick(). When the request finishes,
+// virtio_disk_intr() calls bdone() on each buffer with
+// b->ioasync set, and wakes up virtio_disk_wait() for the
+// others. Returns -1, having queued nothing, if there
+// aren't enough free descriptors.
+int
+virtio_disk_start(struct buf *b, int write)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  int idx[MAXSEG+2];
+  int i, n = 0;
+  struct buf *bp;
+
+  for(bp = b; bp; bp = bp->qnext)
+    n++;
+  if(n > MAXSEG)
+    panic("virtio_disk_start: too many blocks");
 
   acquire(&disk.vdisk_lock);
 
   // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
-
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
+  // one descriptor for type/reserved/sector, then the data,
+  // then one for a 1-byte status result; the data can be
+  // spread over several descriptors, one per buffer here.
+  if(allocn_desc(idx, n+2) < 0){
+    release(&disk.vdisk_lock);
+    return -1;
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -242,58 +258,79 @@ virtio_disk_rw(struct buf *b, int write)
   else
     buf0->type = VIRTIO_BLK_T_IN; // read the disk
   buf0->reserved = 0;
-  buf0->sector = sector;
+  buf0->sector = b->ioblock * (BSIZE / 512);
 
   disk.desc[idx[0]].addr = (uint64) buf0;
   disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1, bp = b; bp; i++, bp = bp->qnext){
+    disk.desc[idx[i]].addr = (uint64) bp->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads bp->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes bp->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  disk.desc[idx[i]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[i]].len = 1;
+  disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[i]].next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
+  // record the buffers for virtio_disk_intr().
   disk.info[idx[0]].b = b;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  disk.avail->ring[disk.avail->idx % disk.num] = idx[0];
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  disk.avail->idx += 1; // not % num ...
 
-  __sync_synchronize();
+  disk.unkicked++;
+
+  release(&disk.vdisk_lock);
+  return 0;
+}
 
-  *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+// Notify the device of the requests virtio_disk_start() has
+// published, with a single write for however many there are.
+void
+virtio_disk_kick(void)
+{
+  acquire(&disk.vdisk_lock);
+  if(disk.unkicked > 0){
+    disk.unkicked = 0;
+    __sync_synchronize();
+    *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  }
+  release(&disk.vdisk_lock);
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
+// Wait for the disk to finish with b, which was queued
+// (by iostart()) with b->disk set and b->ioasync clear.
+void
+virtio_disk_wait(struct buf *b)
+{
+  acquire(&disk.vdisk_lock);
   while(b->disk == 1) {
     sleep(b, &disk.vdisk_lock);
   }
-
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
-
   release(&disk.vdisk_lock);
 }
 
 void
 virtio_disk_intr()
 {
+  struct buf *b, *next;
+  int done = 0;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -311,17 +348,31 @@ virtio_disk_intr()
 
   while(disk.used_idx != disk.used->idx){
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+    int id = disk.used->ring[disk.used_idx % disk.num].id;
 
     if(disk.info[id].status != 0)
       panic("virtio_disk_intr status");
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+    for(b = disk.info[id].b; b; b = next){
+      next = b->qnext;
+      b->qnext = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->ioasync)
+        bdone(b);
+      else
+        wakeup(b);
+    }
+    disk.info[id].b = 0;
+    free_chain(id);
+    done = 1;
 
     disk.used_idx += 1;
   }
 
   release(&disk.vdisk_lock);
+
+  // descriptors have been freed: send the
+  // I/O scheduler's queued requests.
+  if(done)
+    iokick();
 }
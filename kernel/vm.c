@@ -5,6 +5,8 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
 
 /*
  * the kernel's page table.
@@ -168,7 +170,8 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 }
 
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never faulted in (see
+// vmfault()) are skipped.
 // Optionally free the physical memory.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
@@ -181,9 +184,9 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 
   for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
     if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
+      continue;
     if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
+      continue;
     if(PTE_FLAGS(*pte) == PTE_V)
       panic("uvmunmap: not a leaf");
     if(do_free){
@@ -301,8 +304,10 @@ uvmfree(pagetable_t pagetable, uint64 sz)
 
 // Given a parent process's page table, copy
 // its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// The physical pages are shared, not copied:
+// writable pages become read-only copy-on-write
+// pages in both page tables, and uvmcow() gives
+// a process its own copy when it first writes one.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
@@ -311,22 +316,17 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   pte_t *pte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+    if((pte = walk(old, i, 0)) == 0 || (*pte & PTE_V) == 0)
+      continue;  // not faulted in yet; the child will fault it in itself.
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
-      goto err;
-    }
+    kaddref((void*)pa);
   }
   return 0;
 
@@ -335,6 +335,171 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give the page at virtual address va, which must be
+// a copy-on-write page, a private writable copy.
+// If nobody else shares the physical page, it is
+// simply made writable again.
+// Returns 0 on success, -1 if va is not a copy-on-write
+// page or there's no memory for the copy.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+
+  if(krefcnt((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Return the demand-paged program segment of p
+// that contains va, or 0.
+static struct seg*
+findseg(struct proc *p, uint64 va)
+{
+  for(struct seg *s = p->seg; s < &p->seg[p->nseg]; s++){
+    if(va >= s->va && va < s->va + s->memsz)
+      return s;
+  }
+  return 0;
+}
+
+// Handle a page fault at user virtual address va in
+// pagetable, which must be the current process's.
+// A write to a copy-on-write page gets a private copy;
+// a page of a program segment is read from the executable;
+// an untouched heap page below p->sz (sbrk() only
+// reserves address space) gets a fresh zeroed page;
+// anything above p->sz is left to mmapfault().
+// Reading from the executable sleeps, so callers that
+// hold a spinlock must use uvmpagein() beforehand.
+// Returns 0 if the access can now be retried, -1 if
+// va is not a valid address or memory ran out.
+int
+vmfault(pagetable_t pagetable, uint64 va, int write)
+{
+  struct proc *p = myproc();
+  struct seg *s;
+  pte_t *pte;
+  char *mem;
+  int perm = PTE_W;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & PTE_V)){
+    if(write && (*pte & PTE_COW))
+      return uvmcow(pagetable, va);
+    if(write && p && pagetable == p->pagetable && va >= p->sz)
+      return mmapfault(p, va, write);
+    return -1;
+  }
+
+  if(p == 0 || pagetable != p->pagetable)
+    return -1;
+  if(va >= p->sz)
+    return mmapfault(p, va, write);
+
+  if((s = findseg(p, va)) != 0){
+    perm = s->perm;
+    if(write && (perm & PTE_W) == 0)
+      return -1;
+  }
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+
+  if(s && va - s->va < s->filesz){
+    uint n = s->filesz - (va - s->va);
+    if(n > PGSIZE)
+      n = PGSIZE;
+    ilock(p->exe);
+    if(readi(p->exe, 0, (uint64)mem, s->off + (va - s->va), n) != n){
+      iunlock(p->exe);
+      kfree(mem);
+      return -1;
+    }
+    iunlock(p->exe);
+  }
+
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_R|PTE_U|perm) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Fault in the pages of [va, va+len) that vmfault() would
+// have to read from the executable or a mapped file, so that a following
+// copyin()/copyout() of that range doesn't sleep. Used before
+// copying under a spinlock, or under an inode lock that
+// vmfault() might need.
+void
+uvmpagein(uint64 va, uint64 len)
+{
+  struct proc *p = myproc();
+  pte_t *pte;
+  uint64 a, end, send;
+
+  mmappagein(p, va, len);
+  if(va >= p->sz)
+    return;
+  end = len > p->sz - va ? p->sz : va + len;
+  for(struct seg *s = p->seg; s < &p->seg[p->nseg]; s++){
+    a = PGROUNDDOWN(va) > s->va ? PGROUNDDOWN(va) : s->va;
+    send = end < s->va + s->filesz ? end : s->va + s->filesz;
+    for(; a < send; a += PGSIZE){
+      pte = walk(p->pagetable, a, 0);
+      if(pte == 0 || (*pte & PTE_V) == 0)
+        vmfault(p->pagetable, a, 0);
+    }
+  }
+}
+
+// Look up user virtual address va for a copy by the kernel,
+// first faulting the page in (or giving it a private copy,
+// or making a shared mapping writable, if write) just as a
+// user access would.
+// Returns the physical address, or 0 if the access is not allowed.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int write)
+{
+  pte_t *pte;
+
+  if(va >= MAXVA)
+    return 0;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0 || (write && (*pte & PTE_W) == 0)){
+    if(vmfault(pagetable, va, write) < 0)
+      return 0;
+    pte = walk(pagetable, va, 0);
+  }
+  if((*pte & PTE_U) == 0 || (write && (*pte & PTE_W) == 0))
+    return 0;
+  return PTE2PA(*pte);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -358,7 +523,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 1);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (dstva - va0);
@@ -383,7 +548,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -410,7 +575,7 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 0);
     if(pa0 == 0)
       return -1;
     n = PGSIZE - (srcva - va0);
@@ -22,8 +22,9 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
+int nibitmap = NINODES/(BSIZE*8) + 1;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, inode bitmap, bitmap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
@@ -34,12 +35,14 @@ uint freeblock;
 
 
 void balloc(int);
+void iballoc(int);
 void wsect(uint, void*);
 void winode(uint, struct dinode*);
 void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void wdir(uint inum, struct dirent *de, int n);
 void die(const char *);
 
 // convert to riscv byte order
@@ -69,10 +72,10 @@ int
 main(int argc, char *argv[])
 {
   int i, cc, fd;
-  uint rootino, inum, off;
-  struct dirent de;
+  uint rootino, inum;
+  int nde;
+  static struct dirent de[NINODES+2];  // the root directory
   char buf[BSIZE];
-  struct dinode din;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
@@ -90,7 +93,7 @@ main(int argc, char *argv[])
     die(argv[1]);
 
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
+  nmeta = 2 + nlog + ninodeblocks + nibitmap + nbitmap;
   nblocks = FSSIZE - nmeta;
 
   sb.magic = FSMAGIC;
@@ -100,10 +103,11 @@ main(int argc, char *argv[])
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
-  sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.ibmapstart = xint(2+nlog+ninodeblocks);
+  sb.bmapstart = xint(2+nlog+ninodeblocks+nibitmap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, inode bitmap blocks %u, bitmap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nibitmap, nbitmap, nblocks, FSSIZE);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
@@ -117,15 +121,11 @@ main(int argc, char *argv[])
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
 
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, ".");
-  iappend(rootino, &de, sizeof(de));
-
-  bzero(&de, sizeof(de));
-  de.inum = xshort(rootino);
-  strcpy(de.name, "..");
-  iappend(rootino, &de, sizeof(de));
+  de[0].inum = xshort(rootino);
+  strcpy(de[0].name, ".");
+  de[1].inum = xshort(rootino);
+  strcpy(de[1].name, "..");
+  nde = 2;
 
   for(i = 2; i < argc; i++){
     // get rid of "user/"
@@ -149,10 +149,10 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nde < NINODES+2);
+    de[nde].inum = xshort(inum);
+    strncpy(de[nde].name, shortname, DIRSIZ);
+    nde++;
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -160,18 +160,94 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
-  rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  wdir(rootino, de, nde);
 
   balloc(freeblock);
+  iballoc(freeinode);
 
   exit(0);
 }
 
+// Must agree with dirhash() in kernel/fs.c.
+uint
+dirhash(char *name)
+{
+  uint h = 2166136261;
+
+  for(int i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// Write the n entries de[], the first two being "." and "..",
+// as the content of directory inum: a linear directory if they
+// fit in one block, or else a hashed one (see kernel/fs.c) with
+// an index just deep enough that no bucket overflows.
+void
+wdir(uint inum, struct dirent *de, int n)
+{
+  char buf[BSIZE];
+  struct dirent *bde = (struct dirent*)buf;
+  struct dxhead *h = (struct dxhead*)buf + 2;
+  int cnt[1 << DXMAXDEPTH];
+  int depth, nb, fits, i, j, k;
+
+  if(n <= DPB){
+    bzero(buf, BSIZE);
+    memmove(buf, de, n * sizeof(*de));
+    iappend(inum, buf, BSIZE);
+    return;
+  }
+
+  for(depth = 1; ; depth++){
+    assert(depth <= DXMAXDEPTH);
+    nb = 1 << depth;
+    bzero(cnt, sizeof(cnt));
+    fits = 1;
+    for(i = 2; i < n; i++)
+      if(++cnt[dirhash(de[i].name) & (nb - 1)] > DPB - 1)
+        fits = 0;
+    if(fits)
+      break;
+  }
+
+  // block 0: ".", "..", the header and the index,
+  // which points at buckets 1..nb in order.
+  bzero(buf, BSIZE);
+  bde[0] = de[0];
+  bde[1] = de[1];
+  h->magic = xshort(DXMAGIC);
+  h->depth = xint(depth);
+  for(i = 0; i < nb; i++)
+    ((struct dxslot*)buf)[3 + i/DXPERSLOT].blk[i%DXPERSLOT] = xint(1 + i);
+  iappend(inum, buf, BSIZE);
+
+  for(j = 0; j < nb; j++){
+    bzero(buf, BSIZE);
+    for(i = 2, k = 1; i < n; i++)  // slot 0 is the chain link
+      if((dirhash(de[i].name) & (nb - 1)) == j)
+        bde[k++] = de[i];
+    iappend(inum, buf, BSIZE);
+  }
+}
+
+// Mark inodes 0..used-1 allocated in the inode bitmap.
+void
+iballoc(int used)
+{
+  uchar buf[BSIZE];
+  int i;
+
+  assert(used < BSIZE*8);
+  bzero(buf, BSIZE);
+  for(i = 0; i < used; i++){
+    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  }
+  wsect(sb.ibmapstart, buf);
+}
+
 void
 wsect(uint sec, void *buf)
 {
@@ -257,7 +333,7 @@ iappend(uint inum, void *xp, int n)
   struct dinode din;
   char buf[BSIZE];
   uint indirect[NINDIRECT];
-  uint x;
+  uint x, ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -270,7 +346,7 @@ iappend(uint inum, void *xp, int n)
         din.addrs[fbn] = xint(freeblock++);
       }
       x = xint(din.addrs[fbn]);
-    } else {
+    } else if(fbn < NDIRECT + NINDIRECT){
       if(xint(din.addrs[NDIRECT]) == 0){
         din.addrs[NDIRECT] = xint(freeblock++);
       }
@@ -280,6 +356,23 @@ iappend(uint inum, void *xp, int n)
         wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
       }
       x = xint(indirect[fbn-NDIRECT]);
+    } else {
+      // double indirect.
+      if(xint(din.addrs[NDIRECT+1]) == 0){
+        din.addrs[NDIRECT+1] = xint(freeblock++);
+      }
+      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      if(indirect[(fbn - NDIRECT - NINDIRECT) / NINDIRECT] == 0){
+        indirect[(fbn - NDIRECT - NINDIRECT) / NINDIRECT] = xint(freeblock++);
+        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
+      }
+      ind = xint(indirect[(fbn - NDIRECT - NINDIRECT) / NINDIRECT]);
+      rsect(ind, (char*)indirect);
+      if(indirect[(fbn - NDIRECT - NINDIRECT) % NINDIRECT] == 0){
+        indirect[(fbn - NDIRECT - NINDIRECT) % NINDIRECT] = xint(freeblock++);
+        wsect(ind, (char*)indirect);
+      }
+      x = xint(indirect[(fbn - NDIRECT - NINDIRECT) % NINDIRECT]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -0,0 +1,76 @@
+// Fork/exec throughput benchmark.
+//   forkexec [nworkers [iterations]]
+// Each worker forks and execs a trivial program (forkexec
+// itself, which exits at once) iterations times; prints the
+// total elapsed time. Compare "kstat sched" before and after
+// to see how the work spread across CPUs.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+void
+worker(int iters)
+{
+  char *argv[] = { "forkexec", "-x", 0 };
+  int i, pid, xstatus;
+
+  for(i = 0; i < iters; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkexec: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      exec(argv[0], argv);
+      fprintf(2, "forkexec: exec failed\n");
+      exit(1);
+    }
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  exit(0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nworkers = 4, iters = 100;
+  int i, xstatus, failed = 0;
+  uint64 start, elapsed;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);
+  if(argc > 1)
+    nworkers = atoi(argv[1]);
+  if(argc > 2)
+    iters = atoi(argv[2]);
+  if(nworkers < 1 || iters < 1){
+    fprintf(2, "usage: forkexec [nworkers [iterations]]\n");
+    exit(1);
+  }
+
+  start = gettime();
+  for(i = 0; i < nworkers; i++){
+    int pid = fork();
+    if(pid < 0){
+      fprintf(2, "forkexec: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      worker(iters);
+  }
+  for(i = 0; i < nworkers; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      failed = 1;
+  }
+  elapsed = gettime() - start;
+
+  if(failed){
+    fprintf(2, "forkexec: a worker failed\n");
+    exit(1);
+  }
+  printf("%d fork/execs in %l ms\n", nworkers * iters, elapsed / 1000000);
+  exit(0);
+}
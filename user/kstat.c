@@ -0,0 +1,112 @@
+// Print kernel statistics.
+//   kstat [kmem | sched | bcache | disk | dcache]
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/kstat.h"
+#include "user/user.h"
+
+void
+kmem(void)
+{
+  struct kmemstat st;
+  int i;
+
+  if(kstat(KSTAT_KMEM, &st, sizeof(st)) < 0){
+    fprintf(2, "kstat: kmem failed\n");
+    exit(1);
+  }
+  printf("cpu\tfree\thit\tsteal\tfail\n");
+  for(i = 0; i < NCPU; i++){
+    if(st.cpu[i].nfree == 0 && st.cpu[i].nhit == 0 && st.cpu[i].nsteal == 0)
+      continue;
+    printf("%d\t%l\t%l\t%l\t%l\n", i, st.cpu[i].nfree, st.cpu[i].nhit,
+           st.cpu[i].nsteal, st.cpu[i].nfail);
+  }
+}
+
+void
+sched(void)
+{
+  struct schedstat st;
+  int i;
+
+  if(kstat(KSTAT_SCHED, &st, sizeof(st)) < 0){
+    fprintf(2, "kstat: sched failed\n");
+    exit(1);
+  }
+  printf("cpu\trunq\trun\tsteal\tidle\n");
+  for(i = 0; i < NCPU; i++){
+    if(st.cpu[i].nrun == 0 && st.cpu[i].idle == 0)
+      continue;
+    printf("%d\t%l\t%l\t%l\t%l\n", i, st.cpu[i].len, st.cpu[i].nrun,
+           st.cpu[i].nsteal, st.cpu[i].idle);
+  }
+}
+
+void
+bcache(void)
+{
+  struct bcachestat st;
+
+  if(kstat(KSTAT_BCACHE, &st, sizeof(st)) < 0){
+    fprintf(2, "kstat: bcache failed\n");
+    exit(1);
+  }
+  printf("bufs\ttarget\thit\tmiss\tevict\tshrink\treadahead\n");
+  printf("%l\t%l\t%l\t%l\t%l\t%l\t%l\n", st.nbuf, st.target, st.nhit,
+         st.nmiss, st.nevict, st.nshrink, st.nreadahead);
+}
+
+void
+disk(void)
+{
+  struct diskstat st;
+
+  if(kstat(KSTAT_DISK, &st, sizeof(st)) < 0){
+    fprintf(2, "kstat: disk failed\n");
+    exit(1);
+  }
+  printf("blocks\trequests\n");
+  printf("%l\t%l\n", st.nblock, st.nreq);
+}
+
+void
+dcache(void)
+{
+  struct dcachestat st;
+
+  if(kstat(KSTAT_DCACHE, &st, sizeof(st)) < 0){
+    fprintf(2, "kstat: dcache failed\n");
+    exit(1);
+  }
+  printf("hit\tnegative\tmiss\n");
+  printf("%l\t%l\t%l\n", st.nhit, st.nneg, st.nmiss);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc <= 1 || strcmp(argv[1], "kmem") == 0){
+    kmem();
+    exit(0);
+  }
+  if(strcmp(argv[1], "sched") == 0){
+    sched();
+    exit(0);
+  }
+  if(strcmp(argv[1], "bcache") == 0){
+    bcache();
+    exit(0);
+  }
+  if(strcmp(argv[1], "disk") == 0){
+    disk();
+    exit(0);
+  }
+  if(strcmp(argv[1], "dcache") == 0){
+    dcache();
+    exit(0);
+  }
+  fprintf(2, "usage: kstat [kmem | sched | bcache | disk | dcache]\n");
+  exit(1);
+}
@@ -0,0 +1,86 @@
+// Pipe ping-pong latency benchmark.
+//   pingpong [nsleepers [rounds]]
+// Two processes bounce a byte back and forth over a pair
+// of pipes, rounds times, while nsleepers other processes
+// sit blocked in read() on a third pipe, to show how the
+// cost of sleep()/wakeup() depends on the number of
+// processes in the system. Prints the mean round trip time.
+
+#include "kernel/types.h"
+#include "user/user.h"
+
+int
+main(int argc, char *argv[])
+{
+  int nsleepers = 0, rounds = 10000;
+  int idle[2], ping[2], pong[2];
+  int i, pid;
+  uint64 start, elapsed;
+  char c = 0;
+
+  if(argc > 1)
+    nsleepers = atoi(argv[1]);
+  if(argc > 2)
+    rounds = atoi(argv[2]);
+  if(nsleepers < 0 || rounds < 1){
+    fprintf(2, "usage: pingpong [nsleepers [rounds]]\n");
+    exit(1);
+  }
+
+  if(pipe(idle) < 0){
+    fprintf(2, "pingpong: pipe failed\n");
+    exit(1);
+  }
+  for(i = 0; i < nsleepers; i++){
+    pid = fork();
+    if(pid < 0){
+      fprintf(2, "pingpong: only %d sleepers\n", i);
+      break;
+    }
+    if(pid == 0){
+      // block until the parent closes its end.
+      close(idle[1]);
+      read(idle[0], &c, 1);
+      exit(0);
+    }
+  }
+  nsleepers = i;
+  close(idle[0]);
+
+  if(pipe(ping) < 0 || pipe(pong) < 0){
+    fprintf(2, "pingpong: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pingpong: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(idle[1]);
+    for(i = 0; i < rounds; i++){
+      if(read(ping[0], &c, 1) != 1 || write(pong[1], &c, 1) != 1){
+        fprintf(2, "pingpong: child i/o failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  start = gettime();
+  for(i = 0; i < rounds; i++){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1){
+      fprintf(2, "pingpong: parent i/o failed\n");
+      break;
+    }
+  }
+  elapsed = gettime() - start;
+
+  close(idle[1]);
+  for(i = 0; i < nsleepers + 1; i++)
+    wait(0);
+
+  printf("%d sleepers: %d round trips, %l ns each\n",
+         nsleepers, rounds, elapsed / rounds);
+  exit(0);
+}
@@ -0,0 +1,79 @@
+// Pipe throughput benchmark.
+//   pipebw [kbytes [chunk [pipesize]]]
+// A child writes kbytes KiB into a pipe, chunk bytes per
+// write(), and the parent reads them back chunk bytes at a
+// time. If pipesize is given, the pipe's buffer is resized
+// to it first with fcntl(F_SETPIPE_SZ). Prints the time
+// taken and the throughput.
+
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define MAXCHUNK 65536
+
+char buf[MAXCHUNK];
+
+int
+main(int argc, char *argv[])
+{
+  int kbytes = 4096, chunk = 4096, size = 0;
+  int p[2], pid, n, xstatus;
+  uint64 total, left, got, start, elapsed;
+
+  if(argc > 1)
+    kbytes = atoi(argv[1]);
+  if(argc > 2)
+    chunk = atoi(argv[2]);
+  if(argc > 3)
+    size = atoi(argv[3]);
+  if(kbytes < 1 || chunk < 1 || chunk > MAXCHUNK || size < 0){
+    fprintf(2, "usage: pipebw [kbytes [chunk [pipesize]]]\n");
+    exit(1);
+  }
+
+  if(pipe(p) < 0){
+    fprintf(2, "pipebw: pipe failed\n");
+    exit(1);
+  }
+  if(size > 0 && fcntl(p[1], F_SETPIPE_SZ, size) < 0){
+    fprintf(2, "pipebw: cannot set pipe size to %d\n", size);
+    exit(1);
+  }
+  total = (uint64)kbytes * 1024;
+
+  start = gettime();
+  pid = fork();
+  if(pid < 0){
+    fprintf(2, "pipebw: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    close(p[0]);
+    for(left = total; left > 0; left -= n){
+      n = left < chunk ? left : chunk;
+      if(write(p[1], buf, n) != n){
+        fprintf(2, "pipebw: write failed\n");
+        exit(1);
+      }
+    }
+    exit(0);
+  }
+
+  close(p[1]);
+  for(got = 0; (n = read(p[0], buf, chunk)) > 0; got += n)
+    ;
+  wait(&xstatus);
+  elapsed = gettime() - start;
+
+  if(got != total || xstatus != 0){
+    fprintf(2, "pipebw: read %l of %l bytes\n", got, total);
+    exit(1);
+  }
+  if(elapsed < 1000000)
+    elapsed = 1000000;
+  printf("%d KiB through a %d-byte pipe in %l ms: %l KiB/s\n", kbytes,
+         fcntl(p[0], F_GETPIPE_SZ, 0), elapsed / 1000000,
+         (uint64)kbytes * 1000 / (elapsed / 1000000));
+  exit(0);
+}
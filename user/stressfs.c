@@ -12,6 +12,7 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/uring.h"
 
 int
 main(int argc, char *argv[])
@@ -19,6 +20,8 @@ main(int argc, char *argv[])
   int fd, i;
   char path[] = "stressfs0";
   char data[512];
+  struct uring *r;
+  struct sqe *e;
 
   printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
@@ -31,9 +34,23 @@ main(int argc, char *argv[])
 
   path[8] += i;
   fd = open(path, O_CREATE | O_RDWR);
-  for(i = 0; i < 20; i++)
-//    printf(fd, "%d\n", i);
-    write(fd, data, sizeof(data));
+  // queue the writes, and have the kernel do them all at once.
+  if((r = uring_setup()) == (struct uring*)-1){
+    fprintf(2, "stressfs: uring_setup failed\n");
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    e = &r->sq[r->sqtail % URING_NSQ];
+    e->op = URING_WRITE;
+    e->fd = fd;
+    e->addr = (uint64)data;
+    e->n = sizeof(data);
+    e->data = i;
+    r->sqtail++;
+  }
+  if(uring_enter(20) != 20)
+    fprintf(2, "stressfs: uring_enter failed\n");
+  r->cqhead = r->cqtail;
   close(fd);
 
   printf("read\n");
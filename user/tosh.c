@@ -203,6 +203,7 @@ bool too_many_arguments_error(int num, char *cmd, char *usage);
  * Execution Functions
  */
  int execvp(char *pathname, char **args);
+ int splice_cat(struct command *cmd);
  void execute_pipeline(struct command *cmd);
  int execute(char *cmd);
 
@@ -556,6 +557,37 @@ int execvp(char *pathname, char **args)
 }
 
 
+/**
+ * Runs a bare `cat` with its input or output redirected by copying stdin to stdout
+ * inside the kernel with splice(), instead of exec'ing cat to copy it through a buffer
+ *
+ * @param cmd The last command of a pipeline, with its redirections already set up
+ * @return an exit status
+ * 	 - `0` if the data was copied
+ * 	 - `1` if splice failed
+ * 	 - `-1` if this isn't a redirected bare `cat`
+ */
+int splice_cat(struct command *cmd)
+{
+	int n;
+
+	if (strcmp(cmd->tokens[0], "cat") != 0 || cmd->tokens[1] != NULL)
+	{
+		return -1;
+	}
+
+	if (cmd->stdin_file == NULL && cmd->stdout_file == NULL)
+	{
+		return -1;
+	}
+
+	while ((n = splice(0, 1, 65536)) > 0)
+		;
+
+	return n == 0 ? 0 : 1;
+}
+
+
 /**
  * Execute a list of commands where the output of the previous becomes the input of the next
  *
@@ -669,6 +701,14 @@ execute_pipeline(struct command *cmd)
 	  	}
 	 }
   	
+	// `cat < in > out` Needs no cat: Splice stdin to stdout
+	int status = splice_cat(&cmd[i]);
+
+	if (status >= 0)
+	{
+		exit(status);
+	}
+
 	// 1 More Command Left: Doesn't Write to a Pipe
 	execvp(cmd[i].tokens[0], cmd[i].tokens);
 
@@ -1,4 +1,6 @@
 struct stat;
+struct pollfd;
+struct uring;
 
 // system calls
 int fork(void);
@@ -24,6 +26,15 @@ int sleep(int);
 int uptime(void);
 int getcwd(char *, int);
 uint64 gettime(void);
+int kstat(int, void*, int);
+int fsync(int);
+int fcntl(int, int, int);
+int splice(int, int, int);
+int poll(struct pollfd*, int, int);
+struct uring *uring_setup(void);
+int uring_enter(int);
+void *mmap(int, int, int, int, int);
+int munmap(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
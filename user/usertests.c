@@ -4,6 +4,9 @@
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
+#include "kernel/poll.h"
+#include "kernel/uring.h"
+#include "kernel/mman.h"
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
@@ -575,6 +578,51 @@ writetest(char *s)
   }
 }
 
+// fsync() waits for a commit of the log; the file must
+// still read back afterwards, and a bad fd must fail.
+void
+fsynctest(char *s)
+{
+  int fd, i;
+
+  fd = open("fsyncf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create fsyncf failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 20; i++){
+    if(write(fd, "fsyncfsync", 10) != 10){
+      printf("%s: write fsyncf failed\n", s);
+      exit(1);
+    }
+    if(i % 5 == 0 && fsync(fd) != 0){
+      printf("%s: fsync failed\n", s);
+      exit(1);
+    }
+  }
+  if(fsync(fd) != 0 || fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf("%s: fsync of closed fd succeeded\n", s);
+    exit(1);
+  }
+
+  fd = open("fsyncf", O_RDONLY);
+  if(fd < 0 || read(fd, buf, sizeof(buf)) != 200){
+    printf("%s: read fsyncf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("fsyncf");
+}
+
+// enough blocks to need some double-indirect ones;
+// MAXFILE itself would take too long.
+#define NBIG (NDIRECT + NINDIRECT + 2*NINDIRECT + 7)
+
 void
 writebig(char *s)
 {
@@ -586,7 +634,7 @@ writebig(char *s)
     exit(1);
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < NBIG; i++){
     ((int*)buf)[0] = i;
     if(write(fd, buf, BSIZE) != BSIZE){
       printf("%s: error: write big file failed\n", s, i);
@@ -606,7 +654,7 @@ writebig(char *s)
   for(;;){
     i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != NBIG){
         printf("%s: read only %d blocks from big", s, n);
         exit(1);
       }
@@ -629,6 +677,72 @@ writebig(char *s)
   }
 }
 
+// lookups must see creates and unlinks, even of names
+// whose absence or presence the dentry cache remembers,
+// and a new directory must not inherit a freed one's names.
+void
+dcachetest(char *s)
+{
+  int fd, i;
+
+  for(i = 0; i < 2; i++){
+    if((fd = open("dcf", O_RDONLY)) >= 0){
+      printf("%s: open dcf before create succeeded\n", s);
+      close(fd);
+      exit(1);
+    }
+    fd = open("dcf", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf("%s: create dcf failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if((fd = open("dcf", O_RDONLY)) < 0){
+      printf("%s: open dcf after create failed\n", s);
+      exit(1);
+    }
+    close(fd);
+    if(unlink("dcf") < 0){
+      printf("%s: unlink dcf failed\n", s);
+      exit(1);
+    }
+  }
+
+  if(mkdir("dcd") < 0 || (fd = open("dcd/x", O_CREATE|O_RDWR)) < 0){
+    printf("%s: mkdir dcd or create dcd/x failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dcd/x", O_RDONLY)) < 0){
+    printf("%s: lookup of dcd/x failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if((fd = open("dcd/y", O_RDONLY)) >= 0){
+    printf("%s: lookup of dcd/y succeeded\n", s);
+    close(fd);
+    exit(1);
+  }
+  if(unlink("dcd/x") < 0 || unlink("dcd") < 0){
+    printf("%s: unlink dcd failed\n", s);
+    exit(1);
+  }
+  // likely gets the same inode number.
+  if(mkdir("dcd") < 0){
+    printf("%s: mkdir dcd again failed\n", s);
+    exit(1);
+  }
+  if((fd = open("dcd/x", O_RDONLY)) >= 0){
+    printf("%s: dcd/x survived its directory\n", s);
+    close(fd);
+    exit(1);
+  }
+  if(unlink("dcd") < 0){
+    printf("%s: unlink dcd again failed\n", s);
+    exit(1);
+  }
+}
+
 // many creates, followed by unlink test
 void
 createtest(char *s)
@@ -716,73 +830,678 @@ exectest(char *s)
     printf("%s: open failed\n", s);
     exit(1);
   }
-  if (read(fd, buf, 2) != 2) {
-    printf("%s: read failed\n", s);
+  if (read(fd, buf, 2) != 2) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  unlink("echo-ok");
+  if(buf[0] == 'O' && buf[1] == 'K')
+    exit(0);
+  else {
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+}
+
+// a running program's file can't be opened for writing or
+// written through a descriptor opened before it ran.
+void
+textbusy(char *s)
+{
+  int fd, wfd, in[2], out[2], n, pid, xstatus;
+  char *argv[] = { "tbcat", 0 };
+  char c;
+
+  if((fd = open("cat", O_RDONLY)) < 0 ||
+     (wfd = open("tbcat", O_CREATE|O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  while((n = read(fd, buf, sizeof(buf))) > 0){
+    if(write(wfd, buf, n) != n){
+      printf("%s: copy cat failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(pipe(in) < 0 || pipe(out) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(0);
+    dup(in[0]);
+    close(1);
+    dup(out[1]);
+    close(in[0]);
+    close(in[1]);
+    close(out[0]);
+    close(out[1]);
+    close(wfd);
+    exec("tbcat", argv);
+    exit(1);
+  }
+  close(in[0]);
+  close(out[1]);
+
+  // tbcat echoing a byte is running.
+  if(write(in[1], "x", 1) != 1 || read(out[0], &c, 1) != 1 || c != 'x'){
+    printf("%s: tbcat didn't run\n", s);
+    exit(1);
+  }
+  if(open("tbcat", O_WRONLY) >= 0 || open("tbcat", O_RDONLY|O_TRUNC) >= 0){
+    printf("%s: opened a running program for writing\n", s);
+    exit(1);
+  }
+  if(write(wfd, "y", 1) != -1){
+    printf("%s: wrote a running program\n", s);
+    exit(1);
+  }
+  close(in[1]);
+  close(out[0]);
+  wait(&xstatus);
+
+  if(write(wfd, "y", 1) != 1){
+    printf("%s: can't write the program after it exited\n", s);
+    exit(1);
+  }
+  close(wfd);
+  unlink("tbcat");
+}
+
+// simple fork and pipe read/write
+
+void
+pipe1(char *s)
+{
+  int fds[2], pid, xstatus;
+  int seq, i, n, cc, total;
+  enum { N=5, SZ=1033 };
+  
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  seq = 0;
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < N; n++){
+      for(i = 0; i < SZ; i++)
+        buf[i] = seq++;
+      if(write(fds[1], buf, SZ) != SZ){
+        printf("%s: pipe1 oops 1\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  } else if(pid > 0){
+    close(fds[1]);
+    total = 0;
+    cc = 1;
+    while((n = read(fds[0], buf, cc)) > 0){
+      for(i = 0; i < n; i++){
+        if((buf[i] & 0xff) != (seq++ & 0xff)){
+          printf("%s: pipe1 oops 2\n", s);
+          return;
+        }
+      }
+      total += n;
+      cc = cc * 2;
+      if(cc > sizeof(buf))
+        cc = sizeof(buf);
+    }
+    if(total != N * SZ){
+      printf("%s: pipe1 oops 3 total %d\n", total);
+      exit(1);
+    }
+    close(fds[0]);
+    wait(&xstatus);
+    exit(xstatus);
+  } else {
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+}
+
+// fcntl() resizes a pipe's buffer, keeping what's in it.
+void
+pipesize(char *s)
+{
+  int fds[2], i, n;
+  static char pbuf[16384];
+
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_GETPIPE_SZ, 0) != PGSIZE){
+    printf("%s: default pipe size is not a page\n", s);
+    exit(1);
+  }
+  if(write(fds[1], "abc", 3) != 3){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  // rounded up to a power of two pages.
+  if(fcntl(fds[1], F_SETPIPE_SZ, 10000) != 4*PGSIZE ||
+     fcntl(fds[0], F_GETPIPE_SZ, 0) != 4*PGSIZE){
+    printf("%s: F_SETPIPE_SZ failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, 1 << 30) != -1 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 0) != -1){
+    printf("%s: F_SETPIPE_SZ accepted a bad size\n", s);
+    exit(1);
+  }
+
+  // now the whole new buffer can be filled without blocking.
+  for(i = 0; i < sizeof(pbuf); i++)
+    pbuf[i] = i;
+  if(write(fds[1], pbuf, sizeof(pbuf) - 3) != sizeof(pbuf) - 3){
+    printf("%s: write into resized pipe failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[1], F_SETPIPE_SZ, PGSIZE) != -1){
+    printf("%s: shrank a pipe below its contents\n", s);
+    exit(1);
+  }
+  if(read(fds[0], pbuf, 3) != 3 || pbuf[0] != 'a' || pbuf[2] != 'c'){
+    printf("%s: lost the bytes written before resizing\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(pbuf) - 3; i += n){
+    n = read(fds[0], pbuf + i, sizeof(pbuf) - 3 - i);
+    if(n <= 0){
+      printf("%s: read failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < sizeof(pbuf) - 3; i++){
+    if((pbuf[i] & 0xff) != (i & 0xff)){
+      printf("%s: pipe data wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if((fds[0] = open(".", O_RDONLY)) < 0){
+    printf("%s: open . failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETPIPE_SZ, PGSIZE) != -1 || fcntl(fds[0], F_GETPIPE_SZ, 0) != -1){
+    printf("%s: fcntl pipe size of a non-pipe succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+}
+
+// splice() a file into a pipe, from a pipe into a file,
+// and from a file into a file, and check the data survives.
+void
+splicetest(char *s)
+{
+  enum { N = 10000 };
+  static char sbuf[N];
+  int fd, fds[2], pid, xstatus, i, n, tot;
+
+  for(i = 0; i < N; i++)
+    sbuf[i] = 'a' + i % 23;
+  fd = open("splice0", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, sbuf, N) != N){
+    printf("%s: create splice0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // splice0 -> pipe -> splice1, in two processes so that
+  // the pipe fills up and the child has to wait for room.
+  if(pipe(fds) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    if((fd = open("splice0", O_RDONLY)) < 0)
+      exit(1);
+    for(tot = 0; (n = splice(fd, fds[1], 3000)) > 0; tot += n)
+      ;
+    exit(n == 0 && tot == N ? 0 : 1);
+  }
+  close(fds[1]);
+  if((fd = open("splice1", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create splice1 failed\n", s);
+    exit(1);
+  }
+  for(tot = 0; (n = splice(fds[0], fd, N)) > 0; tot += n)
+    ;
+  close(fds[0]);
+  close(fd);
+  wait(&xstatus);
+  if(n < 0 || tot != N || xstatus != 0){
+    printf("%s: splice through a pipe moved %d bytes\n", s, tot);
+    exit(1);
+  }
+
+  // splice1 -> splice2, file to file.
+  if((fd = open("splice1", O_RDONLY)) < 0 ||
+     (fds[1] = open("splice2", O_CREATE|O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(splice(fd, fds[1], N + 100) != N || splice(fd, fds[1], 100) != 0){
+    printf("%s: file to file splice failed\n", s);
+    exit(1);
+  }
+  if(splice(fds[1], fd, 10) != -1){
+    printf("%s: spliced to a read-only file\n", s);
+    exit(1);
+  }
+  close(fd);
+  close(fds[1]);
+
+  if((fd = open("splice2", O_RDONLY)) < 0){
+    printf("%s: open splice2 failed\n", s);
+    exit(1);
+  }
+  memset(sbuf, 0, N);
+  if(read(fd, sbuf, N) != N || read(fd, sbuf, 1) != 0){
+    printf("%s: splice2 has the wrong size\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    if(sbuf[i] != 'a' + i % 23){
+      printf("%s: spliced data wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink("splice0");
+  unlink("splice1");
+  unlink("splice2");
+}
+
+// O_NONBLOCK pipes, and one process poll()ing several pipes.
+void
+polltest(char *s)
+{
+  static char pbuf[1000];
+  struct pollfd pfd[3];
+  int fds[3][2], i, n, tot, pid, nopen, got, xstatus;
+  char c;
+
+  if(pipe(fds[0]) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0][0], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[0][0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK) ||
+     fcntl(fds[0][1], F_GETFL, 0) != O_WRONLY){
+    printf("%s: F_SETFL/F_GETFL failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0][0], &c, 1) != -1){
+    printf("%s: non-blocking read of an empty pipe didn't fail\n", s);
+    exit(1);
+  }
+  fcntl(fds[0][1], F_SETFL, O_NONBLOCK);
+  for(tot = 0; (n = write(fds[0][1], pbuf, sizeof(pbuf))) > 0; tot += n)
+    ;
+  if(tot != fcntl(fds[0][1], F_GETPIPE_SZ, 0)){
+    printf("%s: non-blocking writes filled %d bytes\n", s, tot);
+    exit(1);
+  }
+  pfd[0].fd = fds[0][1];
+  pfd[0].events = POLLOUT;
+  pfd[1].fd = fds[0][0];
+  pfd[1].events = POLLIN;
+  if(poll(pfd, 2, 0) != 1 || pfd[0].revents != 0 || pfd[1].revents != POLLIN){
+    printf("%s: poll of a full pipe is wrong\n", s);
+    exit(1);
+  }
+  close(fds[0][0]);
+  close(fds[0][1]);
+
+  // nothing to read: the timeout runs out.
+  pipe(fds[0]);
+  pfd[0].fd = fds[0][0];
+  pfd[0].events = POLLIN;
+  if(poll(pfd, 1, 2) != 0 || pfd[0].revents != 0){
+    printf("%s: poll didn't time out\n", s);
+    exit(1);
+  }
+  close(fds[0][0]);
+  close(fds[0][1]);
+
+  // three children write a byte each, at different times.
+  for(i = 0; i < 3; i++){
+    if(pipe(fds[i]) < 0){
+      printf("%s: pipe() failed\n", s);
+      exit(1);
+    }
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[i][0]);
+      sleep(3 - i);
+      c = 'a' + i;
+      write(fds[i][1], &c, 1);
+      exit(0);
+    }
+    close(fds[i][1]);
+    pfd[i].fd = fds[i][0];
+    pfd[i].events = POLLIN;
+  }
+  got = 0;
+  for(nopen = 3; nopen > 0; ){
+    if(poll(pfd, 3, -1) <= 0){
+      printf("%s: poll failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < 3; i++){
+      if((pfd[i].revents & (POLLIN|POLLHUP)) == 0)
+        continue;
+      if((n = read(pfd[i].fd, &c, 1)) == 1){
+        if(c != 'a' + i){
+          printf("%s: wrong byte from pipe %d\n", s, i);
+          exit(1);
+        }
+        got++;
+      } else {
+        close(pfd[i].fd);
+        pfd[i].fd = -1;
+        nopen--;
+      }
+    }
+  }
+  for(i = 0; i < 3; i++){
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(1);
+  }
+  if(got != 3){
+    printf("%s: got %d bytes\n", s, got);
+    exit(1);
+  }
+}
+
+// Queue opens, writes, reads and closes on the ring, and
+// check their completions.
+void
+uringtest(char *s)
+{
+  enum { NW = 40, SZ = 100 };
+  static char ubuf[NW*SZ];
+  static char path[] = "uring0";
+  struct uring *r;
+  struct sqe *e;
+  struct cqe *c;
+  int i, fd, pid, xstatus;
+
+  if((r = uring_setup()) == (struct uring*)-1 || uring_setup() != r){
+    printf("%s: uring_setup failed\n", s);
+    exit(1);
+  }
+
+  // one open, then NW writes and a close in one batch.
+  e = &r->sq[r->sqtail % URING_NSQ];
+  e->op = URING_OPEN;
+  e->addr = (uint64)path;
+  e->n = O_CREATE|O_RDWR;
+  e->data = 77;
+  r->sqtail++;
+  c = &r->cq[r->cqhead % URING_NCQ];
+  if(uring_enter(1) != 1 || r->cqtail != r->cqhead + 1 || c->data != 77 || c->res < 0){
+    printf("%s: URING_OPEN failed\n", s);
+    exit(1);
+  }
+  fd = c->res;
+  r->cqhead++;
+
+  for(i = 0; i < NW*SZ; i++)
+    ubuf[i] = 'A' + i % 31;
+  for(i = 0; i <= NW; i++){
+    e = &r->sq[r->sqtail % URING_NSQ];
+    e->op = i < NW ? URING_WRITE : URING_CLOSE;
+    e->fd = fd;
+    e->addr = (uint64)(ubuf + i*SZ);
+    e->n = SZ;
+    e->data = i;
+    r->sqtail++;
+  }
+  if(uring_enter(NW + 10) != NW + 1){
+    printf("%s: uring_enter didn't run the batch\n", s);
+    exit(1);
+  }
+  for(i = 0; i <= NW; i++){
+    c = &r->cq[r->cqhead % URING_NCQ];
+    if(c->data != i || c->res != (i < NW ? SZ : 0)){
+      printf("%s: completion %d is wrong\n", s, i);
+      exit(1);
+    }
+    r->cqhead++;
+  }
+  if(write(fd, ubuf, 1) != -1){
+    printf("%s: URING_CLOSE didn't close\n", s);
+    exit(1);
+  }
+
+  // read it back with plain read().
+  memset(ubuf, 0, sizeof(ubuf));
+  if((fd = open(path, O_RDONLY)) < 0 || read(fd, ubuf, sizeof(ubuf)) != sizeof(ubuf)){
+    printf("%s: reading back failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < NW*SZ; i++){
+    if(ubuf[i] != 'A' + i % 31){
+      printf("%s: wrong data at %d\n", s, i);
+      exit(1);
+    }
+  }
+  unlink(path);
+
+  // a full completion queue stops the kernel.
+  for(i = 0; i < URING_NCQ + 1; i++){
+    e = &r->sq[r->sqtail % URING_NSQ];
+    e->op = URING_NOP;
+    e->data = i;
+    r->sqtail++;
+    if(i == URING_NCQ - 1 && uring_enter(URING_NCQ) != URING_NCQ){
+      printf("%s: NOPs didn't run\n", s);
+      exit(1);
+    }
+  }
+  if(uring_enter(1) != 0){
+    printf("%s: ran with a full completion queue\n", s);
+    exit(1);
+  }
+  r->cqhead = r->cqtail;
+  if(uring_enter(1) != 1){
+    printf("%s: didn't run after the queue drained\n", s);
+    exit(1);
+  }
+  r->cqhead = r->cqtail;
+
+  // a child doesn't inherit the ring.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0)
+    exit(uring_enter(1) == -1 ? 0 : 1);
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: child used the parent's ring\n", s);
+    exit(1);
+  }
+}
+
+// mmap() a file privately and shared, and check what
+// reaches the file, from the parent, a child, and munmap().
+void
+mmaptest(char *s)
+{
+  enum { SZ = 2*PGSIZE + PGSIZE/2 };
+  static char mbuf[SZ];
+  int fd, fd1, fds[2], fds1[2], i, pid, xstatus;
+  char *p;
+
+  for(i = 0; i < SZ; i++)
+    mbuf[i] = 'a' + i % 26;
+  fd = open("mmap0", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, mbuf, SZ) != SZ){
+    printf("%s: create mmap0 failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a private mapping of a read-only fd can be written,
+  // and the file doesn't see it.
+  fd = open("mmap0", O_RDONLY);
+  if(mmap(fd, 0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED) != MAP_FAILED ||
+     mmap(fd, 100, SZ, PROT_READ, MAP_PRIVATE) != MAP_FAILED){
+    printf("%s: bad mmap succeeded\n", s);
+    exit(1);
+  }
+  p = mmap(fd, 0, SZ, PROT_READ|PROT_WRITE, MAP_PRIVATE);
+  if(p == MAP_FAILED){
+    printf("%s: private mmap failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < SZ; i++){
+    if(p[i] != 'a' + i % 26){
+      printf("%s: mapped data wrong at %d\n", s, i);
+      exit(1);
+    }
+  }
+  for(i = SZ; i < 3*PGSIZE; i++){
+    if(p[i] != 0){
+      printf("%s: past the end of the file isn't zero\n", s);
+      exit(1);
+    }
+  }
+  // the kernel copies out of mapped pages it hasn't seen yet.
+  fd1 = open("mmap1", O_CREATE|O_RDWR);
+  if(fd1 < 0 || write(fd1, p, SZ) != SZ){
+    printf("%s: write from a mapping failed\n", s);
+    exit(1);
+  }
+  close(fd1);
+  unlink("mmap1");
+  p[0] = 'X';
+  if(munmap(p, SZ) != 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+  fd = open("mmap0", O_RDONLY);
+  if(read(fd, mbuf, 1) != 1 || mbuf[0] != 'a'){
+    printf("%s: private write reached the file\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  // a shared mapping: unmapping the first page writes it
+  // back; a child's writes are written back when it exits,
+  // or by the parent, which shares the page, when it unmaps
+  // the rest.
+  fd = open("mmap0", O_RDWR);
+  p = mmap(fd, 0, SZ, PROT_READ|PROT_WRITE, MAP_SHARED);
+  if(p == MAP_FAILED){
+    printf("%s: shared mmap failed\n", s);
+    exit(1);
+  }
+  p[0] = 'A';
+  p[2*PGSIZE] = 'C';
+  p[SZ] = 'Z';  // past the end of the file
+  if(munmap(p + PGSIZE, PGSIZE) != -1){
+    printf("%s: munmap left a hole\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) != 0){
+    printf("%s: munmap of the first page failed\n", s);
+    exit(1);
+  }
+  if(read(fd, mbuf, 1) != 1 || mbuf[0] != 'A'){
+    printf("%s: shared write wasn't written back\n", s);
+    exit(1);
+  }
+  // the child's write to a page neither touched before the
+  // fork reaches the parent while the child still runs.
+  if(pipe(fds) < 0 || pipe(fds1) < 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[PGSIZE] = 'B';
+    write(fds[1], "x", 1);
+    read(fds1[0], mbuf, 1);
+    exit(0);
+  }
+  if(read(fds[0], mbuf, 1) != 1 || p[PGSIZE] != 'B'){
+    printf("%s: child's shared write not seen by parent\n", s);
+    exit(1);
+  }
+  write(fds1[1], "x", 1);
+  wait(&xstatus);
+  if(xstatus != 0)
+    exit(1);
+  close(fds[0]);
+  close(fds[1]);
+  close(fds1[0]);
+  close(fds1[1]);
+  if(munmap(p + PGSIZE, 2*PGSIZE) != 0){
+    printf("%s: munmap of the rest failed\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("mmap0", O_RDONLY);
+  memset(mbuf, 0, SZ);
+  if(read(fd, mbuf, SZ) != SZ || read(fd, mbuf, 1) != 0){
+    printf("%s: write-back changed the file's size\n", s);
     exit(1);
   }
-  unlink("echo-ok");
-  if(buf[0] == 'O' && buf[1] == 'K')
-    exit(0);
-  else {
-    printf("%s: wrong output\n", s);
+  close(fd);
+  if(mbuf[0] != 'A' || mbuf[PGSIZE] != 'B' || mbuf[2*PGSIZE] != 'C' ||
+     mbuf[1] != 'b' || mbuf[SZ-1] != 'a' + (SZ-1) % 26){
+    printf("%s: file has the wrong data after write-back\n", s);
     exit(1);
   }
 
-}
-
-// simple fork and pipe read/write
-
-void
-pipe1(char *s)
-{
-  int fds[2], pid, xstatus;
-  int seq, i, n, cc, total;
-  enum { N=5, SZ=1033 };
-  
-  if(pipe(fds) != 0){
+  if(pipe(fds) < 0){
     printf("%s: pipe() failed\n", s);
     exit(1);
   }
-  pid = fork();
-  seq = 0;
-  if(pid == 0){
-    close(fds[0]);
-    for(n = 0; n < N; n++){
-      for(i = 0; i < SZ; i++)
-        buf[i] = seq++;
-      if(write(fds[1], buf, SZ) != SZ){
-        printf("%s: pipe1 oops 1\n", s);
-        exit(1);
-      }
-    }
-    exit(0);
-  } else if(pid > 0){
-    close(fds[1]);
-    total = 0;
-    cc = 1;
-    while((n = read(fds[0], buf, cc)) > 0){
-      for(i = 0; i < n; i++){
-        if((buf[i] & 0xff) != (seq++ & 0xff)){
-          printf("%s: pipe1 oops 2\n", s);
-          return;
-        }
-      }
-      total += n;
-      cc = cc * 2;
-      if(cc > sizeof(buf))
-        cc = sizeof(buf);
-    }
-    if(total != N * SZ){
-      printf("%s: pipe1 oops 3 total %d\n", total);
-      exit(1);
-    }
-    close(fds[0]);
-    wait(&xstatus);
-    exit(xstatus);
-  } else {
-    printf("%s: fork() failed\n", s);
+  if(mmap(fds[0], 0, PGSIZE, PROT_READ, MAP_PRIVATE) != MAP_FAILED){
+    printf("%s: mapped a pipe\n", s);
     exit(1);
   }
+  close(fds[0]);
+  close(fds[1]);
+  unlink("mmap0");
 }
 
 
@@ -1778,6 +2497,51 @@ bigfile(char *s)
   unlink("bigfile.dat");
 }
 
+// a file well into the double-indirect blocks, written in
+// unaligned pieces so that the writes straddle indirect
+// blocks; then truncated and written again in the blocks it
+// freed.
+void
+hugefile(char *s)
+{
+  enum { NB = NDIRECT + 4*NINDIRECT, SZ = 3*BSIZE + 123 };
+  int fd, i, n, pass, off;
+
+  for(pass = 0; pass < 2; pass++){
+    fd = open("huge", O_CREATE|O_TRUNC|O_RDWR);
+    if(fd < 0){
+      printf("%s: cannot create huge\n", s);
+      exit(1);
+    }
+    for(off = 0; off < NB*BSIZE; off += n){
+      n = NB*BSIZE - off < SZ ? NB*BSIZE - off : SZ;
+      for(i = 0; i < n; i++)
+        buf[i] = (off + i + pass) % 251;
+      if(write(fd, buf, n) != n){
+        printf("%s: write huge at %d failed\n", s, off);
+        exit(1);
+      }
+    }
+    close(fd);
+
+    fd = open("huge", O_RDONLY);
+    for(off = 0; (n = read(fd, buf, BSIZE)) > 0; off += n){
+      for(i = 0; i < n; i++){
+        if((uchar)buf[i] != (off + i + pass) % 251){
+          printf("%s: huge byte %d wrong\n", s, off + i);
+          exit(1);
+        }
+      }
+    }
+    close(fd);
+    if(off != NB*BSIZE){
+      printf("%s: read %d bytes of huge, not %d\n", s, off, NB*BSIZE);
+      exit(1);
+    }
+  }
+  unlink("huge");
+}
+
 void
 fourteen(char *s)
 {
@@ -1916,6 +2680,129 @@ dirfile(char *s)
   close(fd);
 }
 
+// getcwd() follows chdir(), including through "." and "..",
+// even in directories nested deeper than MAXPATH.
+void
+getcwdtest(char *s)
+{
+  enum { DEEP = 20 };
+  char cwd[MAXPATH], want[2*MAXPATH], deep[2*MAXPATH];
+  int i;
+
+  if(chdir("/") < 0 || mkdir("gcd") < 0 || mkdir("gcd/sub") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  if(chdir("/gcd/./sub") < 0 || getcwd(cwd, sizeof(cwd)) < 0 ||
+     strcmp(cwd, "/gcd/sub") != 0){
+    printf("%s: getcwd after chdir: %s\n", s, cwd);
+    exit(1);
+  }
+  if(getcwd(cwd, 4) != -1){
+    printf("%s: getcwd into a short buffer succeeded\n", s);
+    exit(1);
+  }
+  if(chdir("nonexistent") == 0 || getcwd(cwd, sizeof(cwd)) < 0 ||
+     strcmp(cwd, "/gcd/sub") != 0){
+    printf("%s: failed chdir changed cwd to %s\n", s, cwd);
+    exit(1);
+  }
+  if(chdir("../..") < 0 || getcwd(cwd, sizeof(cwd)) < 0 ||
+     strcmp(cwd, "/") != 0){
+    printf("%s: getcwd after chdir ../..: %s\n", s, cwd);
+    exit(1);
+  }
+
+  // deeper than MAXPATH: chdir() still works, and getcwd()
+  // finds the path by walking "..".
+  strcpy(want, "/gcd");
+  chdir("gcd");
+  for(i = 0; i < DEEP; i++){
+    if(mkdir("dddddddddd") < 0 || chdir("dddddddddd") < 0){
+      printf("%s: chdir %d levels deep failed\n", s, i);
+      exit(1);
+    }
+    strcpy(want + strlen(want), "/dddddddddd");
+  }
+  if(getcwd(deep, sizeof(deep)) < 0 || strcmp(deep, want) != 0){
+    printf("%s: getcwd deep: %s\n", s, deep);
+    exit(1);
+  }
+  for(i = 0; i < DEEP; i++){
+    if(chdir("..") < 0 || unlink("dddddddddd") < 0){
+      printf("%s: unlink deep failed\n", s);
+      exit(1);
+    }
+  }
+  if(getcwd(cwd, sizeof(cwd)) < 0 || strcmp(cwd, "/gcd") != 0){
+    printf("%s: getcwd back from deep: %s\n", s, cwd);
+    exit(1);
+  }
+  chdir("/");
+
+  if(unlink("gcd/sub") < 0 || unlink("gcd") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+}
+
+// more distinct inodes in use at once than the old
+// fixed-size inode table (50 entries) could hold.
+void
+manyinodes(char *s)
+{
+  enum { NCHILD = 5, NF = 11 };  // NF fits in NOFILE with the pipes
+  int ready[2], done[2], c, i, fds[NF];
+  char name[8], x;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  for(c = 0; c < NCHILD; c++){
+    int pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(ready[0]);
+      close(done[1]);
+      name[0] = 'm'; name[1] = 'i'; name[2] = 'a' + c; name[4] = '\0';
+      for(i = 0; i < NF; i++){
+        name[3] = 'a' + i;
+        if((fds[i] = open(name, O_CREATE|O_RDWR)) < 0){
+          printf("%s: create %s failed\n", s, name);
+          exit(1);
+        }
+      }
+      // tell the parent, then wait for it to close done.
+      write(ready[1], "x", 1);
+      read(done[0], &x, 1);
+      for(i = 0; i < NF; i++){
+        close(fds[i]);
+        name[3] = 'a' + i;
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  close(ready[1]);
+  for(c = 0; c < NCHILD; c++){
+    if(read(ready[0], &x, 1) != 1){
+      printf("%s: child failed\n", s);
+      exit(1);
+    }
+  }
+  close(done[1]);
+  for(c = 0; c < NCHILD; c++){
+    int xstatus;
+    wait(&xstatus);
+    if(xstatus != 0)
+      exit(xstatus);
+  }
+}
+
 // test that iput() is called at the end of _namei().
 // also tests empty file names.
 void
@@ -1993,6 +2880,73 @@ forktest(char *s)
   }
 }
 
+// fork shares memory copy-on-write. do parent and child
+// each see only their own writes, both from user stores
+// and from the kernel (read() into a shared page)?
+void
+cowfork(char *s)
+{
+  enum { SZ = 4*1024*1024, NCHILD = 40 };
+  int fds[2], pid, xstatus;
+  char *a;
+
+  a = sbrk(SZ);
+  if(a == (char*)0xffffffffffffffffL){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(int i = 0; i < SZ; i += PGSIZE)
+    a[i] = 'p';
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+
+  // NCHILD children, alive at once, would need more than the
+  // machine's 128 megabytes if each one copied SZ bytes. each
+  // waits on the pipe until the parent has forked them all.
+  for(int n = 0; n < NCHILD; n++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[1]);
+      for(int i = 0; i < SZ; i += 16*PGSIZE)
+        a[i] = 'c';
+      if(read(fds[0], a + PGSIZE, 1) != 1)
+        exit(1);
+      for(int i = 0; i < SZ; i += 16*PGSIZE)
+        if(a[i] != 'c')
+          exit(1);
+      exit(a[PGSIZE] == 'k' ? 0 : 1);
+    }
+  }
+  for(int n = 0; n < NCHILD; n++){
+    if(write(fds[1], "k", 1) != 1){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  for(int n = 0; n < NCHILD; n++){
+    wait(&xstatus);
+    if(xstatus != 0){
+      printf("%s: child saw wrong data\n", s);
+      exit(1);
+    }
+  }
+
+  for(int i = 0; i < SZ; i += PGSIZE){
+    if(a[i] != 'p'){
+      printf("%s: parent memory changed at %d\n", s, i);
+      exit(1);
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
 void
 sbrkbasic(char *s)
 {
@@ -2117,6 +3071,40 @@ sbrkmuch(char *s)
   }
 }
 
+// sbrk() only reserves address space, so a process can grow
+// well past physical memory as long as it touches little of it.
+void
+sbrklazy(char *s)
+{
+  enum { BIG=512*1024*1024 };
+  char *oldbrk, *a;
+
+  oldbrk = sbrk(0);
+  a = sbrk(BIG);
+  if(a != oldbrk){
+    printf("%s: sbrk(%d) failed\n", s, BIG);
+    exit(1);
+  }
+  for(uint64 off = 0; off < BIG; off += 64*1024*1024){
+    if(a[off] != 0){
+      printf("%s: lazily allocated page not zero\n", s);
+      exit(1);
+    }
+    a[off+1] = 'x';
+  }
+  // the kernel must fault pages in for system calls too.
+  int fd = open("README", O_RDONLY);
+  if(fd < 0 || read(fd, a + BIG - 8, 8) != 8){
+    printf("%s: read into lazy page failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(sbrk(-BIG) != a + BIG){
+    printf("%s: sbrk shrink failed\n", s);
+    exit(1);
+  }
+}
+
 // can we read the kernel's memory?
 void
 kernmem(char *s)
@@ -2589,11 +3577,19 @@ struct test {
   {iputtest, "iput"},
   {opentest, "opentest"},
   {writetest, "writetest"},
+  {fsynctest, "fsynctest"},
   {writebig, "writebig"},
   {createtest, "createtest"},
+  {dcachetest, "dcachetest"},
   {dirtest, "dirtest"},
   {exectest, "exectest"},
+  {textbusy, "textbusy"},
   {pipe1, "pipe1"},
+  {pipesize, "pipesize"},
+  {splicetest, "splicetest"},
+  {polltest, "polltest"},
+  {uringtest, "uringtest"},
+  {mmaptest, "mmaptest"},
   {killstatus, "killstatus"},
   {preempt, "preempt"},
   {exitwait, "exitwait"},
@@ -2617,9 +3613,13 @@ struct test {
   {rmdot, "rmdot"},
   {dirfile, "dirfile"},
   {iref, "iref"},
+  {manyinodes, "manyinodes"},
+  {getcwdtest, "getcwdtest"},
   {forktest, "forktest"},
+  {cowfork, "cowfork"},
   {sbrkbasic, "sbrkbasic"},
   {sbrkmuch, "sbrkmuch"},
+  {sbrklazy, "sbrklazy"},
   {kernmem, "kernmem"},
   {MAXVAplus, "MAXVAplus"},
   {sbrkfail, "sbrkfail"},
@@ -2684,6 +3684,119 @@ bigdir(char *s)
   }
 }
 
+// a new directory that outgrows its first block becomes
+// hashed, and its buckets split; every entry must stay
+// findable and readable, and it must empty out again.
+// (links, since there aren't enough inodes for N files.)
+void
+hashdir(char *s)
+{
+  enum { N = 600 };
+  int i, fd, n;
+  char name[16];
+  struct dirent de;
+
+  if(mkdir("hd") < 0 || (fd = open("hdf", O_CREATE|O_RDWR)) < 0){
+    printf("%s: mkdir hd failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  for(i = 0; i < N; i++){
+    name[0] = 'h'; name[1] = 'd'; name[2] = '/';
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    name[6] = '\0';
+    if(link("hdf", name) < 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = N-1; i >= 0; i--){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+  }
+
+  fd = open("hd", O_RDONLY);
+  n = 0;
+  while(read(fd, &de, sizeof(de)) == sizeof(de))
+    if(de.inum != 0)
+      n++;
+  close(fd);
+  if(n != N + 2){
+    printf("%s: hd has %d entries, not %d\n", s, n, N + 2);
+    exit(1);
+  }
+
+  if(unlink("hd") == 0){
+    printf("%s: unlink of non-empty hd succeeded\n", s);
+    exit(1);
+  }
+  for(i = 0; i < N; i++){
+    name[3] = 'a' + i / 100;
+    name[4] = '0' + (i / 10) % 10;
+    name[5] = '0' + i % 10;
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hd") < 0 || unlink("hdf") < 0){
+    printf("%s: unlink hd failed\n", s);
+    exit(1);
+  }
+}
+
+// more entries than block 0's index alone reaches, and than
+// fit in 268 blocks, the most a linear directory had before
+// double-indirect blocks, so the index must grow sub-index
+// blocks; every link must succeed and every name stay findable.
+void
+hashdirfull(char *s)
+{
+  enum { N = 268*DPB + 1000 };
+  int i, j, n, fd;
+  char name[16];
+
+  if(mkdir("hf") < 0 || (fd = open("hff", O_CREATE|O_RDWR)) < 0){
+    printf("%s: mkdir hf failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  strcpy(name, "hf/f00000");
+  for(i = 0; i < N; i++){
+    for(n = i, j = 8; j >= 4; n /= 10, j--)
+      name[j] = '0' + n % 10;
+    if(link("hff", name) < 0){
+      printf("%s: link %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  for(i = 0; i < N; i++){
+    for(n = i, j = 8; j >= 4; n /= 10, j--)
+      name[j] = '0' + n % 10;
+    if((fd = open(name, O_RDONLY)) < 0){
+      printf("%s: open %s failed\n", s, name);
+      exit(1);
+    }
+    close(fd);
+    if(unlink(name) < 0){
+      printf("%s: unlink %s failed\n", s, name);
+      exit(1);
+    }
+  }
+  if(unlink("hf") < 0 || unlink("hff") < 0){
+    printf("%s: unlink hf failed\n", s);
+    exit(1);
+  }
+}
+
 // concurrent writes to try to provoke deadlock in the virtio disk
 // driver.
 void
@@ -2926,6 +4039,9 @@ outofinodes(char *s)
 
 struct test slowtests[] = {
   {bigdir, "bigdir"},
+  {hashdir, "hashdir"},
+  {hashdirfull, "hashdirfull"},
+  {hugefile, "hugefile"},
   {manywrites, "manywrites"},
   {badwrite, "badwrite" },
   {execout, "execout"},
@@ -38,3 +38,12 @@ entry("sleep");
 entry("uptime");
 entry("getcwd");
 entry("gettime");
+entry("kstat");
+entry("fsync");
+entry("fcntl");
+entry("splice");
+entry("poll");
+entry("uring_setup");
+entry("uring_enter");
+entry("mmap");
+entry("munmap");